@@ -12,25 +12,44 @@
 #define SLEEP_PROC_SEC  10
 #define SLEEP_TREE_SEC  3
 
-void fork_procs(struct tree_node node)
+/*
+ * Fork a process for every child of node, keeping their pids in
+ * children[], and return NULL; in a forked process, return the child
+ * it is to become instead.
+ */
+struct tree_node *fork_children(struct tree_node *node, pid_t *children)
 {
     pid_t child;
     int i;
-    pid_t* children;
 
-    children = (pid_t*)malloc(node.nr_children * sizeof(pid_t));
-    change_pname(node.name);
-    printf("%s: Hello! I have %i children.\n", node.name, node.nr_children);
-    for (i = 0; i < node.nr_children; ++i) {
-        printf("%s: Forking child %s...\n", node.name, node.children[i].name);
+    change_pname(node->name);
+    printf("%s: Hello! I have %i children.\n", node->name, node->nr_children);
+    for (i = 0; i < node->nr_children; ++i) {
+        printf("%s: Forking child %s...\n", node->name, node->children[i].name);
         child = fork();
         if (child == 0) {
-            fork_procs(node.children[i]);
-            // this point is never reached
-            printf("This should never be displayed.\n");
+            return &node->children[i];
         }
         children[i] = child;
     }
+    return NULL;
+}
+
+void fork_procs(struct tree_node node)
+{
+    struct tree_node *child;
+    int i;
+    pid_t* children;
+
+    /* A forked child goes on as its own node, rather than recursing */
+    for (;;) {
+        children = (pid_t*)malloc(node.nr_children * sizeof(pid_t));
+        child = fork_children(&node, children);
+        if (child == NULL)
+            break;
+        free(children);
+        node = *child;
+    }
     wait_for_ready_children(node.nr_children);
     printf("%s: Waiting for SIGSTOP...\n", node.name);
     raise(SIGSTOP);
@@ -45,23 +45,24 @@ int do_read(int fd, int *data)
     return 0;
 }
 
-void fork_procs(struct tree_node node, int out)
+/*
+ * Fork a process for every child of node, with a pipe from each
+ * one in f[], and return NULL; in a forked process, return the child
+ * it is to become instead, with *out set to its end of the pipe.
+ */
+struct tree_node *fork_children(struct tree_node *node, int f[2][2], int *out)
 {
     pid_t child;
-    pid_t children[2];
     int i;
-    int f[2][2];
-    int a, b;
-    int result;
 
-    change_pname(node.name);
-    printf("%s: Hello! I have %i children.\n", node.name, node.nr_children);
-    if (node.nr_children == 0) {
-        do_write(out, atoi(node.name));
+    change_pname(node->name);
+    printf("%s: Hello! I have %i children.\n", node->name, node->nr_children);
+    if (node->nr_children == 0) {
+        do_write(*out, atoi(node->name));
         exit(0);
     }
-    for (i = 0; i < node.nr_children; ++i) {
-        printf("%s: Forking child %s...\n", node.name, node.children[i].name);
+    for (i = 0; i < node->nr_children; ++i) {
+        printf("%s: Forking child %s...\n", node->name, node->children[i].name);
         pipe(f[i]);
         child = fork();
         if (child < 0) {
@@ -70,12 +71,25 @@ void fork_procs(struct tree_node node, int out)
         }
         if (child == 0) {
             close(f[i][0]);
-            fork_procs(node.children[i], f[i][1]);
-            // this point is never reached
+            *out = f[i][1];
+            return &node->children[i];
         }
-        children[i] = child;
         close(f[i][1]);
     }
+    return NULL;
+}
+
+void fork_procs(struct tree_node node, int out)
+{
+    struct tree_node *child;
+    int f[2][2];
+    int a, b;
+    int result;
+
+    /* A forked child goes on as its own node, rather than recursing */
+    while ((child = fork_children(&node, f, &out)) != NULL) {
+        node = *child;
+    }
 
     do_read(f[0][0], &a);
     do_read(f[1][0], &b);
@@ -7,32 +7,56 @@
 
 #include "proc-common.h"
 #include "tree.h"
+#include "flat-tree.h"
 
 #define SLEEP_PROC_SEC  10
 #define SLEEP_TREE_SEC  3
 
-void fork_procs(struct tree_node* node)
+/*
+ * Fork a process for every child of node, and return FLAT_TREE_NONE;
+ * in a forked process, return the child it is to become instead.
+ */
+unsigned fork_children(struct flat_tree* tree, unsigned node)
 {
+    const char *name = flat_tree_name(tree, node);
     pid_t child;
-    int i;
+    unsigned c;
 
-    change_pname(node->name);
-    printf("%s: Hello! I have %i children.\n", node->name, node->nr_children);
-    for (i = 0; i < node->nr_children; ++i) {
-        printf("%s: Forking child %s...\n", node->name, node->children[i].name);
+    change_pname(name);
+    printf("%s: Hello! I have %i children.\n", name, tree->nr_children[node]);
+    for (c = flat_tree_first_child(tree, node); c != FLAT_TREE_NONE;
+         c = flat_tree_next_sibling(tree, c)) {
+        printf("%s: Forking child %s...\n", name, flat_tree_name(tree, c));
         child = fork();
         if (child == 0) {
-            fork_procs(&node->children[i]);
+            return c;
         }
     }
-    printf("%s: Sleeping...\n", node->name);
-    for (i = 0; i < node->nr_children; ++i) {
+    return FLAT_TREE_NONE;
+}
+
+void fork_procs(struct flat_tree* tree, unsigned node)
+{
+    unsigned child;
+    unsigned nr_children;
+    const char *name;
+    int i;
+
+    /* A forked child goes on as its own node, rather than recursing */
+    while ((child = fork_children(tree, node)) != FLAT_TREE_NONE) {
+        node = child;
+    }
+
+    name = flat_tree_name(tree, node);
+    nr_children = tree->nr_children[node];
+    printf("%s: Sleeping...\n", name);
+    for (i = 0; i < nr_children; ++i) {
         wait(NULL);
     }
-    if (node->nr_children == 0) {
+    if (nr_children == 0) {
         sleep(SLEEP_PROC_SEC);
     }
-    printf("%s: Goodbye...\n", node->name);
+    printf("%s: Goodbye...\n", name);
     exit(0);
 }
 
@@ -45,16 +69,20 @@ int main(int argc, char** argv)
 {
     pid_t pid;
     int status;
-    struct tree_node *root;
+    struct flat_tree *tree;
 
     if (argc != 2) {
         fprintf(stderr, "Usage: %s <input_tree_file>\n\n", argv[0]);
         exit(1);
     }
 
-    root = get_tree_from_file(argv[1]);
+    tree = flat_tree_from_file(argv[1]);
+    if (tree == NULL) {
+        fprintf(stderr, "%s: no tree\n", argv[1]);
+        exit(1);
+    }
     printf("Constructing the following process tree:\n");
-    print_tree(root);
+    flat_tree_print(tree);
 
     /* Fork root of process tree */
     pid = fork();
@@ -64,7 +92,7 @@ int main(int argc, char** argv)
     }
     if (pid == 0) {
         /* Child */
-        fork_procs(root);
+        fork_procs(tree, 0);
         exit(1);
     }
 
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flat-tree.h"
+#include "tree-image.h"
+
+static void *
+xcalloc(size_t nmemb, size_t size)
+{
+	void *ret;
+
+	ret = calloc(nmemb, size);
+	if (ret == NULL){
+		fprintf(stderr, "flat tree allocation failed\n");
+		exit(1);
+	}
+
+	return ret;
+}
+
+/*
+ * Count the nodes and the bytes of their names,
+ * walking the tree with an explicit stack.
+ */
+static void
+measure_tree(struct tree_node *root, unsigned *nr_nodes, size_t *names_size)
+{
+	struct tree_node **stack, *node;
+	size_t sp, cap;
+	unsigned i;
+
+	*nr_nodes = 0;
+	*names_size = 0;
+
+	cap = 64;
+	stack = xcalloc(cap, sizeof(*stack));
+	sp = 0;
+	stack[sp++] = root;
+	while (sp > 0){
+		node = stack[--sp];
+		(*nr_nodes)++;
+		*names_size += strlen(node->name) + 1;
+
+		if (sp + node->nr_children > cap){
+			while (sp + node->nr_children > cap)
+				cap *= 2;
+			stack = realloc(stack, cap * sizeof(*stack));
+			if (stack == NULL){
+				fprintf(stderr, "flat tree allocation failed\n");
+				exit(1);
+			}
+		}
+		for (i = 0; i < node->nr_children; i++)
+			stack[sp++] = &node->children[i];
+	}
+
+	free(stack);
+}
+
+struct flat_tree *
+flat_tree_from_tree(struct tree_node *root)
+{
+	struct flat_tree *tree;
+	struct tree_node **stack, *node;
+	unsigned *stack_parent;
+	size_t names_size, off, len, sp;
+	unsigned n, i, j, c;
+
+	if (root == NULL)
+		return NULL;
+
+	tree = xcalloc(1, sizeof(*tree));
+	measure_tree(root, &tree->nr_nodes, &names_size);
+	n = tree->nr_nodes;
+
+	tree->nr_children = xcalloc(n, sizeof(unsigned));
+	tree->subtree_size = xcalloc(n, sizeof(unsigned));
+	tree->parent = xcalloc(n, sizeof(unsigned));
+	tree->depth = xcalloc(n, sizeof(unsigned));
+	tree->name_off = xcalloc(n, sizeof(unsigned));
+	tree->names = xcalloc(names_size, 1);
+
+	/*
+	 * DFS with an explicit stack, which never holds more than
+	 * all the nodes; children are pushed in reverse, so that
+	 * they are numbered in order.
+	 */
+	stack = xcalloc(n, sizeof(*stack));
+	stack_parent = xcalloc(n, sizeof(unsigned));
+	sp = 0;
+	stack[sp] = root;
+	stack_parent[sp++] = FLAT_TREE_NONE;
+	off = 0;
+	for (i = 0; sp > 0; i++){
+		node = stack[--sp];
+		tree->parent[i] = stack_parent[sp];
+		tree->depth[i] = tree->parent[i] == FLAT_TREE_NONE ?
+			0 : tree->depth[tree->parent[i]] + 1;
+		tree->nr_children[i] = node->nr_children;
+
+		len = strlen(node->name) + 1;
+		memcpy(tree->names + off, node->name, len);
+		tree->name_off[i] = off;
+		off += len;
+
+		for (c = node->nr_children; c-- > 0; ){
+			stack[sp] = &node->children[c];
+			stack_parent[sp++] = i;
+		}
+	}
+	free(stack);
+	free(stack_parent);
+
+	/* subtree sizes, from the leaves up */
+	for (i = n; i-- > 0; ){
+		tree->subtree_size[i] = 1;
+		for (j = i + 1, c = 0; c < tree->nr_children[i]; c++){
+			tree->subtree_size[i] += tree->subtree_size[j];
+			j += tree->subtree_size[j];
+		}
+	}
+
+	return tree;
+}
+
+struct flat_tree *
+flat_tree_from_file(const char *filename)
+{
+	const struct tree_image *img;
+	struct tree_node *root;
+	struct flat_tree *tree;
+
+	if (tree_image_is_compiled(filename)){
+		img = tree_image_open(filename);
+		tree = flat_tree_from_image(img);
+		tree_image_close(img);
+		return tree;
+	}
+
+	root = get_tree_from_file(filename);
+	tree = flat_tree_from_tree(root);
+
+	/* get_tree_from_file() allocates all nodes at once, root first */
+	free(root);
+
+	return tree;
+}
+
+void
+flat_tree_free(struct flat_tree *tree)
+{
+	if (tree == NULL)
+		return;
+
+	free(tree->nr_children);
+	free(tree->subtree_size);
+	free(tree->parent);
+	free(tree->depth);
+	free(tree->name_off);
+	free(tree->names);
+	free(tree);
+}
+
+const char *
+flat_tree_name(const struct flat_tree *tree, unsigned node)
+{
+	return tree->names + tree->name_off[node];
+}
+
+unsigned
+flat_tree_first_child(const struct flat_tree *tree, unsigned node)
+{
+	return tree->nr_children[node] > 0 ? node + 1 : FLAT_TREE_NONE;
+}
+
+unsigned
+flat_tree_next_sibling(const struct flat_tree *tree, unsigned node)
+{
+	unsigned parent = tree->parent[node];
+	unsigned next = node + tree->subtree_size[node];
+
+	if (parent == FLAT_TREE_NONE ||
+	    next >= parent + tree->subtree_size[parent])
+		return FLAT_TREE_NONE;
+	return next;
+}
+
+/*
+ * Same output as print_tree(), in a single scan
+ */
+void
+flat_tree_print(const struct flat_tree *tree)
+{
+	unsigned i, d;
+
+	for (i = 0; i < tree->nr_nodes; i++){
+		for (d = 0; d < tree->depth[i]; d++)
+			printf("\t");
+		printf("%s\n", flat_tree_name(tree, i));
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef FLAT_TREE_H
+#define FLAT_TREE_H
+
+#include "tree.h"
+
+/******************************************************************************
+ * Data structure definitions
+ */
+
+/*
+ * A tree laid out flat, as a structure of arrays indexed by node:
+ * nodes are numbered in DFS preorder, starting with the root at 0,
+ * so the first child of node i is i + 1, its next sibling is
+ * i + subtree_size[i], and its whole subtree is the range
+ * [i, i + subtree_size[i]). Passes over the whole tree are plain
+ * scans of the arrays they need.
+ */
+struct flat_tree {
+	unsigned  nr_nodes;
+	unsigned  *nr_children;
+	unsigned  *subtree_size;   /* including the node itself */
+	unsigned  *parent;         /* FLAT_TREE_NONE for the root */
+	unsigned  *depth;          /* 0 for the root */
+	unsigned  *name_off;       /* into names */
+	char      *names;          /* all names, '\0'-terminated */
+};
+
+#define FLAT_TREE_NONE ((unsigned)-1)
+
+
+/******************************************************************************
+ * Helper Functions
+ */
+
+/* returns a flat copy of the tree rooted at root */
+struct flat_tree *flat_tree_from_tree(struct tree_node *root);
+
+/*
+ * returns the tree defined in a file, laid out flat; the file is
+ * either text, or a tree compiled by tree-compile, which is loaded
+ * without being parsed (programs that use struct tree_node, through
+ * get_tree_from_file(), only read text)
+ */
+struct flat_tree *flat_tree_from_file(const char *filename);
+
+void flat_tree_free(struct flat_tree *tree);
+
+const char *flat_tree_name(const struct flat_tree *tree, unsigned node);
+
+/* these return FLAT_TREE_NONE if there is no such node */
+unsigned flat_tree_first_child(const struct flat_tree *tree, unsigned node);
+unsigned flat_tree_next_sibling(const struct flat_tree *tree, unsigned node);
+
+void flat_tree_print(const struct flat_tree *tree);
+
+#endif /* FLAT_TREE_H */
@@ -0,0 +1,54 @@
+/*
+ * gen-tree.c
+ *
+ * Write deep, narrow trees in the tree file format, to check
+ * that nothing recurses once per level of the tree:
+ *
+ *     chain N    a chain of N nodes, n0 to n(N-1)
+ *     expr N     an expression of N additions, one under the other,
+ *                that adds up N + 1 ones
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void print_chain(long depth)
+{
+	long i;
+
+	for (i = 0; i < depth - 1; i++)
+		printf("n%ld\n1\nn%ld\n\n", i, i + 1);
+	printf("n%ld\n0\n", depth - 1);
+}
+
+void print_expr(long depth)
+{
+	long i;
+
+	/* The left operand is 1, the right one the next addition */
+	for (i = 0; i < depth - 1; i++)
+		printf("+\n2\n1\n+\n\n1\n0\n\n");
+	printf("+\n2\n1\n1\n\n1\n0\n\n1\n0\n");
+}
+
+int main(int argc, char *argv[])
+{
+	long depth;
+
+	if (argc != 3 || (depth = atol(argv[2])) <= 0) {
+		fprintf(stderr, "Usage: %s chain|expr <depth>\n\n", argv[0]);
+		exit(1);
+	}
+
+	if (strcmp(argv[1], "chain") == 0) {
+		print_chain(depth);
+	} else if (strcmp(argv[1], "expr") == 0) {
+		print_expr(depth);
+	} else {
+		fprintf(stderr, "Usage: %s chain|expr <depth>\n\n", argv[0]);
+		exit(1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "strtab.h"
+
+#define STRTAB_CHUNK_SIZE 65536
+
+static void *
+xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (ptr == NULL){
+		fprintf(stderr, "string table allocation failed\n");
+		exit(1);
+	}
+
+	return ptr;
+}
+
+/* FNV-1a */
+static unsigned
+hash_bytes(const char *s, size_t len)
+{
+	unsigned h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++){
+		h ^= (unsigned char)s[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+struct strtab *
+strtab_create(void)
+{
+	struct strtab *tab;
+
+	tab = xrealloc(NULL, sizeof(*tab));
+	memset(tab, 0, sizeof(*tab));
+	tab->nr_buckets = 64;
+	tab->buckets = xrealloc(NULL, tab->nr_buckets * sizeof(unsigned));
+	memset(tab->buckets, 0, tab->nr_buckets * sizeof(unsigned));
+
+	return tab;
+}
+
+/*
+ * Double the buckets, rehashing with the hashes we already have
+ */
+static void
+grow_buckets(struct strtab *tab)
+{
+	unsigned i, b, mask;
+
+	tab->nr_buckets *= 2;
+	mask = tab->nr_buckets - 1;
+	tab->buckets = xrealloc(tab->buckets, tab->nr_buckets * sizeof(unsigned));
+	memset(tab->buckets, 0, tab->nr_buckets * sizeof(unsigned));
+
+	for (i = 0; i < tab->nr_strings; i++){
+		for (b = tab->hash[i] & mask; tab->buckets[b] != 0; b = (b + 1) & mask)
+			;
+		tab->buckets[b] = i + 1;
+	}
+}
+
+/*
+ * Copy a string into the current chunk, starting a new one if
+ * it does not fit; a string longer than a chunk gets its own.
+ */
+static const char *
+store(struct strtab *tab, const char *s, size_t len)
+{
+	char *ret;
+	size_t size;
+
+	if (len + 1 > tab->chunk_left){
+		size = len + 1 > STRTAB_CHUNK_SIZE ? len + 1 : STRTAB_CHUNK_SIZE;
+		tab->chunk = xrealloc(NULL, size);
+		tab->chunk_left = size;
+	}
+
+	ret = tab->chunk;
+	memcpy(ret, s, len);
+	ret[len] = '\0';
+	tab->chunk += len + 1;
+	tab->chunk_left -= len + 1;
+
+	return ret;
+}
+
+unsigned
+strtab_intern(struct strtab *tab, const char *s, size_t len)
+{
+	unsigned h, b, id, mask;
+
+	h = hash_bytes(s, len);
+	mask = tab->nr_buckets - 1;
+	for (b = h & mask; tab->buckets[b] != 0; b = (b + 1) & mask){
+		id = tab->buckets[b] - 1;
+		if (tab->hash[id] == h && tab->len[id] == len &&
+		    memcmp(tab->str[id], s, len) == 0)
+			return id;
+	}
+
+	/* new string */
+	if (tab->nr_strings == tab->capacity){
+		tab->capacity = tab->capacity ? 2 * tab->capacity : 64;
+		tab->str = xrealloc(tab->str, tab->capacity * sizeof(*tab->str));
+		tab->len = xrealloc(tab->len, tab->capacity * sizeof(unsigned));
+		tab->hash = xrealloc(tab->hash, tab->capacity * sizeof(unsigned));
+	}
+	id = tab->nr_strings++;
+	tab->str[id] = store(tab, s, len);
+	tab->len[id] = len;
+	tab->hash[id] = h;
+	tab->buckets[b] = id + 1;
+
+	/* keep the load factor under 1/2 */
+	if (2 * tab->nr_strings > tab->nr_buckets)
+		grow_buckets(tab);
+
+	return id;
+}
+
+const char *
+strtab_str(const struct strtab *tab, unsigned id)
+{
+	return tab->str[id];
+}
+
+unsigned
+strtab_hash(const struct strtab *tab, unsigned id)
+{
+	return tab->hash[id];
+}
@@ -0,0 +1,48 @@
+#ifndef STRTAB_H
+#define STRTAB_H
+
+#include <stddef.h>
+
+/******************************************************************************
+ * Data structure definitions
+ */
+
+/*
+ * A table of interned strings: every distinct string is stored once
+ * and gets a small integer id, in order of first appearance, so that
+ * two strings of the same table are equal if and only if their ids are.
+ *
+ * Strings are kept in chunks that never move, so the pointers
+ * returned by strtab_str() stay valid as the table grows,
+ * for as long as the program runs.
+ */
+struct strtab {
+	unsigned  nr_strings;
+	unsigned  capacity;
+	const char **str;       /* by id */
+	unsigned  *len;         /* by id */
+	unsigned  *hash;        /* by id */
+
+	/* open addressing: id + 1, or 0 for an empty bucket */
+	unsigned  *buckets;
+	unsigned  nr_buckets;   /* a power of two */
+
+	/* where the next string goes */
+	char      *chunk;
+	size_t    chunk_left;
+};
+
+
+/******************************************************************************
+ * Helper Functions
+ */
+
+struct strtab *strtab_create(void);
+
+/* returns the id of the len bytes at s, adding them if new */
+unsigned strtab_intern(struct strtab *tab, const char *s, size_t len);
+
+const char *strtab_str(const struct strtab *tab, unsigned id);
+unsigned strtab_hash(const struct strtab *tab, unsigned id);
+
+#endif /* STRTAB_H */
@@ -0,0 +1,75 @@
+#!/bin/bash
+#
+# Run the tree programs on deep, narrow trees made by gen-tree,
+# with a small stack, so that anything that recurses once per
+# level of the tree crashes:
+#
+#     ./test-deep.sh [parse_depth] [print_depth] [process_depth]
+#
+# Printing a chain of N nodes takes N * N / 2 tabs, and every node
+# of a process tree is a process, so those trees are shallower.
+
+PARSE_DEPTH=${1:-100000}
+PRINT_DEPTH=${2:-20000}
+PROC_DEPTH=${3:-100}
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# 1KiB of stack per level would run out at about 1000 levels
+ulimit -s 1024
+
+fail()
+{
+    echo "FAIL: $*"
+    exit 1
+}
+
+# Parsing: the image of a chain is a header of 56 bytes, 16 bytes
+# per node, 4 per child, and the names
+./gen-tree chain $PARSE_DEPTH > $TMP/parse.tree || fail "gen-tree"
+./tree-compile $TMP/parse.tree $TMP/parse.img || fail "tree-compile, depth $PARSE_DEPTH"
+names=$(seq 0 $((PARSE_DEPTH - 1)) | sed 's/^/n/' | wc -c)
+[ $(stat -c %s $TMP/parse.img) -eq $((56 + 20 * PARSE_DEPTH - 4 + names)) ] ||
+    fail "tree-compile: wrong image size, depth $PARSE_DEPTH"
+echo "parse, depth $PARSE_DEPTH: ok"
+
+# Printing: the last node is on line N, after N - 1 tabs
+./gen-tree chain $PRINT_DEPTH > $TMP/print.tree || fail "gen-tree"
+./tree-example $TMP/print.tree > $TMP/print.out || fail "tree-example, depth $PRINT_DEPTH"
+[ $(wc -l < $TMP/print.out) -eq $PRINT_DEPTH ] || fail "tree-example: wrong number of lines"
+[ "$(tail -n 1 $TMP/print.out)" == "$(printf '\t%.0s' $(seq 2 $PRINT_DEPTH))n$((PRINT_DEPTH - 1))" ] ||
+    fail "tree-example: wrong last line"
+./tree-compile $TMP/print.tree $TMP/print.img || fail "tree-compile, depth $PRINT_DEPTH"
+./tree-compile -p $TMP/print.img | cmp -s - $TMP/print.out || fail "tree-compile -p differs from tree-example"
+echo "print, depth $PRINT_DEPTH: ok"
+
+# Process trees: every process says goodbye once
+./gen-tree chain $PROC_DEPTH > $TMP/proc.tree || fail "gen-tree"
+for prog in ask2-tree ask2-dfs; do
+    ./$prog $TMP/proc.tree > $TMP/$prog.out 2>&1 || fail "$prog, depth $PROC_DEPTH"
+    [ $(grep -c "Goodbye" $TMP/$prog.out) -eq $PROC_DEPTH ] || fail "$prog: not every process finished"
+    echo "$prog, depth $PROC_DEPTH: ok"
+done
+
+# ask2-tree also takes a compiled tree, and must build the same one
+./tree-compile $TMP/proc.tree $TMP/proc.img || fail "tree-compile, depth $PROC_DEPTH"
+./ask2-tree $TMP/proc.img > $TMP/ask2-tree-img.out 2>&1 || fail "ask2-tree on an image, depth $PROC_DEPTH"
+[ $(grep -c "Goodbye" $TMP/ask2-tree-img.out) -eq $PROC_DEPTH ] || fail "ask2-tree on an image: not every process finished"
+# pstree writes straight to the terminal, so it may come first
+tree_listing()
+{
+    grep -m 1 -A $PROC_DEPTH "^Constructing" "$1"
+}
+cmp -s <(tree_listing $TMP/ask2-tree-img.out) <(tree_listing $TMP/ask2-tree.out) ||
+    fail "ask2-tree: image and text trees differ"
+echo "ask2-tree on an image, depth $PROC_DEPTH: ok"
+
+./ask2-signals $TMP/proc.tree > $TMP/ask2-signals.out 2>&1 || fail "ask2-signals, depth $PROC_DEPTH"
+grep -q "is awake" $TMP/ask2-signals.out || fail "ask2-signals: root did not wake up"
+echo "ask2-signals, depth $PROC_DEPTH: ok"
+
+./gen-tree expr $PROC_DEPTH > $TMP/expr.tree || fail "gen-tree"
+./ask2-expr $TMP/expr.tree > $TMP/ask2-expr.out 2>&1 || fail "ask2-expr, depth $PROC_DEPTH"
+grep -q "^Final result: $((PROC_DEPTH + 1))$" $TMP/ask2-expr.out || fail "ask2-expr: wrong result"
+echo "ask2-expr, depth $PROC_DEPTH: ok"
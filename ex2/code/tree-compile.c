@@ -0,0 +1,24 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+#include "tree-image.h"
+
+int main(int argc, char *argv[])
+{
+	if (argc == 3 && strcmp(argv[1], "-p") == 0) {
+		tree_image_print(tree_image_open(argv[2]));
+		return 0;
+	}
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <input_tree_file> <output_file>\n"
+			"       %s -p <compiled_tree_file>\n\n", argv[0], argv[0]);
+		exit(1);
+	}
+
+	tree_image_write(get_tree_from_file(argv[1]), argv[2]);
+
+	return 0;
+}
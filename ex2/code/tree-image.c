@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "flat-tree.h"
+#include "strtab.h"
+#include "tree-image.h"
+
+static void
+xfwrite(const void *ptr, size_t size, FILE *file, const char *filename)
+{
+	if (size > 0 && fwrite(ptr, size, 1, file) != 1){
+		perror(filename);
+		exit(1);
+	}
+}
+
+/*
+ * Lay the tree out flat first: its preorder is the order of the
+ * nodes in the image, and the children of every node are then
+ * consecutive entries of the child table.
+ */
+void
+tree_image_write(struct tree_node *root, const char *filename)
+{
+	struct flat_tree *flat;
+	struct strtab *names;
+	struct tree_image hdr;
+	struct tree_image_node *nodes;
+	uint32_t *children, *name_off;
+	uint32_t i, c, k, nr_names;
+	size_t names_size;
+	const char *name;
+	FILE *file;
+
+	flat = flat_tree_from_tree(root);
+	if (flat == NULL){
+		fprintf(stderr, "%s: no tree to compile\n", filename);
+		exit(1);
+	}
+
+	nodes = calloc(flat->nr_nodes, sizeof(*nodes));
+	children = calloc(flat->nr_nodes, sizeof(*children));
+	name_off = calloc(flat->nr_nodes, sizeof(*name_off));
+	if (nodes == NULL || children == NULL || name_off == NULL){
+		fprintf(stderr, "tree image allocation failed\n");
+		exit(1);
+	}
+
+	/* names, each once; name_off[] by id */
+	names = strtab_create();
+	nr_names = 0;
+	names_size = 0;
+	for (i = 0, k = 0; i < flat->nr_nodes; i++){
+		name = flat_tree_name(flat, i);
+		nodes[i].name = strtab_intern(names, name, strlen(name));
+		if (nodes[i].name == nr_names){
+			name_off[nr_names++] = names_size;
+			names_size += strlen(name) + 1;
+		}
+		nodes[i].name = name_off[nodes[i].name];
+
+		nodes[i].nr_children = flat->nr_children[i];
+		nodes[i].subtree_size = flat->subtree_size[i];
+		nodes[i].children = k;
+		for (c = flat_tree_first_child(flat, i); c != FLAT_TREE_NONE;
+		     c = flat_tree_next_sibling(flat, c))
+			children[k++] = c;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TREE_IMAGE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TREE_IMAGE_VERSION;
+	hdr.nr_nodes = flat->nr_nodes;
+	hdr.nodes_off = sizeof(hdr);
+	hdr.children_off = hdr.nodes_off + (uint64_t)hdr.nr_nodes * sizeof(*nodes);
+	hdr.names_off = hdr.children_off + (uint64_t)(hdr.nr_nodes - 1) * sizeof(*children);
+	hdr.names_size = names_size;
+	hdr.file_size = hdr.names_off + names_size;
+
+	file = fopen(filename, "w");
+	if (file == NULL){
+		perror(filename);
+		exit(1);
+	}
+	xfwrite(&hdr, sizeof(hdr), file, filename);
+	xfwrite(nodes, hdr.nr_nodes * sizeof(*nodes), file, filename);
+	xfwrite(children, (hdr.nr_nodes - 1) * sizeof(*children), file, filename);
+	for (i = 0; i < nr_names; i++)
+		xfwrite(strtab_str(names, i), strlen(strtab_str(names, i)) + 1, file, filename);
+	if (fclose(file) != 0){
+		perror(filename);
+		exit(1);
+	}
+
+	free(nodes);
+	free(children);
+	free(name_off);
+	flat_tree_free(flat);
+}
+
+const struct tree_image *
+tree_image_open(const char *filename)
+{
+	int fd;
+	struct stat st;
+	struct tree_image *img;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0){
+		perror(filename);
+		exit(1);
+	}
+	if (st.st_size < sizeof(*img)){
+		fprintf(stderr, "%s: not a compiled tree\n", filename);
+		exit(1);
+	}
+
+	img = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (img == MAP_FAILED){
+		perror(filename);
+		exit(1);
+	}
+	close(fd);
+
+	if (memcmp(img->magic, TREE_IMAGE_MAGIC, sizeof(img->magic)) != 0){
+		fprintf(stderr, "%s: not a compiled tree\n", filename);
+		exit(1);
+	}
+	if (img->version != TREE_IMAGE_VERSION){
+		fprintf(stderr, "%s: compiled tree version %u, expected %u\n",
+			filename, img->version, TREE_IMAGE_VERSION);
+		exit(1);
+	}
+	if (img->nr_nodes == 0 || img->file_size != st.st_size ||
+	    img->nodes_off + (uint64_t)img->nr_nodes * sizeof(struct tree_image_node) > img->children_off ||
+	    img->children_off + (uint64_t)(img->nr_nodes - 1) * sizeof(uint32_t) > img->names_off ||
+	    img->names_off + img->names_size != img->file_size){
+		fprintf(stderr, "%s: corrupt compiled tree\n", filename);
+		exit(1);
+	}
+
+	return img;
+}
+
+const struct tree_image_node *
+tree_image_node(const struct tree_image *img, uint32_t node)
+{
+	return (const struct tree_image_node *)((const char *)img + img->nodes_off) + node;
+}
+
+const char *
+tree_image_name(const struct tree_image *img, uint32_t node)
+{
+	return (const char *)img + img->names_off + tree_image_node(img, node)->name;
+}
+
+uint32_t
+tree_image_child(const struct tree_image *img, uint32_t node, uint32_t i)
+{
+	const uint32_t *children = (const uint32_t *)((const char *)img + img->children_off);
+
+	return children[tree_image_node(img, node)->children + i];
+}
+
+/*
+ * Same output as print_tree(): in preorder, a node is as deep as
+ * the number of subtrees, started before it, that it falls into.
+ */
+void
+tree_image_print(const struct tree_image *img)
+{
+	uint32_t *end, depth, i, d;
+
+	end = calloc(img->nr_nodes, sizeof(*end));
+	if (end == NULL){
+		fprintf(stderr, "tree image allocation failed\n");
+		exit(1);
+	}
+
+	depth = 0;
+	for (i = 0; i < img->nr_nodes; i++){
+		while (depth > 0 && i >= end[depth - 1])
+			depth--;
+		for (d = 0; d < depth; d++)
+			printf("\t");
+		printf("%s\n", tree_image_name(img, i));
+		end[depth++] = i + tree_image_node(img, i)->subtree_size;
+	}
+
+	free(end);
+}
+
+void
+tree_image_close(const struct tree_image *img)
+{
+	munmap((void *)img, img->file_size);
+}
+
+/* whether filename starts like a compiled tree, rather than text */
+int
+tree_image_is_compiled(const char *filename)
+{
+	char magic[sizeof(((struct tree_image *)0)->magic)];
+	FILE *file;
+	int ret;
+
+	file = fopen(filename, "r");
+	if (file == NULL)
+		return 0;
+	ret = fread(magic, sizeof(magic), 1, file) == 1 &&
+	      memcmp(magic, TREE_IMAGE_MAGIC, sizeof(magic)) == 0;
+	fclose(file);
+
+	return ret;
+}
+
+/*
+ * Lay a compiled tree out flat in one scan of its nodes: they are
+ * already in preorder with their subtree sizes, so only parents and
+ * depths are worked out, keeping the open subtrees on a stack as
+ * tree_image_print() does. Nothing is parsed.
+ */
+struct flat_tree *
+flat_tree_from_image(const struct tree_image *img)
+{
+	const struct tree_image_node *node;
+	struct flat_tree *tree;
+	uint32_t *open, *end, depth, i;
+
+	tree = calloc(1, sizeof(*tree));
+	if (tree == NULL){
+		fprintf(stderr, "tree image allocation failed\n");
+		exit(1);
+	}
+	tree->nr_nodes = img->nr_nodes;
+	tree->nr_children = calloc(img->nr_nodes, sizeof(unsigned));
+	tree->subtree_size = calloc(img->nr_nodes, sizeof(unsigned));
+	tree->parent = calloc(img->nr_nodes, sizeof(unsigned));
+	tree->depth = calloc(img->nr_nodes, sizeof(unsigned));
+	tree->name_off = calloc(img->nr_nodes, sizeof(unsigned));
+	tree->names = malloc(img->names_size);
+	open = calloc(img->nr_nodes, sizeof(*open));
+	end = calloc(img->nr_nodes, sizeof(*end));
+	if (tree->nr_children == NULL || tree->subtree_size == NULL ||
+	    tree->parent == NULL || tree->depth == NULL ||
+	    tree->name_off == NULL || tree->names == NULL ||
+	    open == NULL || end == NULL){
+		fprintf(stderr, "tree image allocation failed\n");
+		exit(1);
+	}
+	memcpy(tree->names, (const char *)img + img->names_off, img->names_size);
+
+	depth = 0;
+	for (i = 0; i < img->nr_nodes; i++){
+		node = tree_image_node(img, i);
+		while (depth > 0 && i >= end[depth - 1])
+			depth--;
+		tree->parent[i] = depth > 0 ? open[depth - 1] : FLAT_TREE_NONE;
+		tree->depth[i] = depth;
+		tree->nr_children[i] = node->nr_children;
+		tree->subtree_size[i] = node->subtree_size;
+		tree->name_off[i] = node->name;
+		open[depth] = i;
+		end[depth++] = i + node->subtree_size;
+	}
+
+	free(open);
+	free(end);
+	return tree;
+}
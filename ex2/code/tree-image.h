@@ -0,0 +1,74 @@
+#ifndef TREE_IMAGE_H
+#define TREE_IMAGE_H
+
+#include <stdint.h>
+
+#include "tree.h"
+#include "flat-tree.h"
+
+/******************************************************************************
+ * Data structure definitions
+ */
+
+/*
+ * A compiled tree file, made by tree-compile, to be mapped and used
+ * in place: a header, the nodes in DFS preorder with the root first,
+ * a table of child indices, and a table of '\0'-terminated names,
+ * each stored once. Offsets are from the start of the file, and
+ * integers are in the byte order of the machine that compiled it.
+ */
+#define TREE_IMAGE_MAGIC   "TREEIMG"
+#define TREE_IMAGE_VERSION 1
+
+struct tree_image {
+	char      magic[8];
+	uint32_t  version;
+	uint32_t  nr_nodes;
+	uint64_t  nodes_off;       /* struct tree_image_node[nr_nodes] */
+	uint64_t  children_off;    /* uint32_t[nr_nodes - 1] */
+	uint64_t  names_off;       /* names_size bytes */
+	uint64_t  names_size;
+	uint64_t  file_size;
+};
+
+struct tree_image_node {
+	uint32_t  name;            /* offset in the name table */
+	uint32_t  nr_children;
+	uint32_t  children;        /* first entry in the child table */
+	uint32_t  subtree_size;    /* including the node itself */
+};
+
+
+/******************************************************************************
+ * Helper Functions
+ */
+
+/* compile the tree rooted at root into filename */
+void tree_image_write(struct tree_node *root, const char *filename);
+
+/*
+ * map a compiled tree file read-only; only the header is checked,
+ * so this takes the same time for any size of tree
+ */
+const struct tree_image *tree_image_open(const char *filename);
+
+const struct tree_image_node *tree_image_node(const struct tree_image *img, uint32_t node);
+const char *tree_image_name(const struct tree_image *img, uint32_t node);
+
+/* the index of the i-th child of node */
+uint32_t tree_image_child(const struct tree_image *img, uint32_t node, uint32_t i);
+
+void tree_image_print(const struct tree_image *img);
+
+void tree_image_close(const struct tree_image *img);
+
+/* whether filename is a compiled tree rather than a text one */
+int tree_image_is_compiled(const char *filename);
+
+/*
+ * returns a flat copy of a compiled tree, made in one scan of its
+ * nodes; flat_tree_from_file() uses it for compiled files
+ */
+struct flat_tree *flat_tree_from_image(const struct tree_image *img);
+
+#endif /* TREE_IMAGE_H */
@@ -3,82 +3,160 @@
 #include <unistd.h>
 #include <assert.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/prctl.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "tree.h"
 
-#define BUFF_SIZE 1024
+/*
+ * The path from the root to the node being visited, to walk
+ * the tree without recursion: it takes memory by the depth
+ * of the tree, and not from the stack of the process.
+ */
+struct tree_path {
+	struct tree_frame {
+		struct tree_node *node;
+		unsigned next;        /* the next child to visit */
+	} *frames;
+	unsigned long depth;
+	unsigned long size;
+};
 
 static void
-__print_tree(struct tree_node *root, int level)
+path_push(struct tree_path *path, struct tree_node *node)
 {
-	int i;
-	for (i=0; i<level; i++)
-		printf("\t");
-	printf("%s\n", root->name);
+	if (path->depth == path->size){
+		path->size = path->size ? 2 * path->size : 64;
+		path->frames = realloc(path->frames, path->size * sizeof(*path->frames));
+		if (path->frames == NULL){
+			fprintf(stderr, "tree path allocation failed\n");
+			exit(1);
+		}
+	}
+	path->frames[path->depth].node = node;
+	path->frames[path->depth].next = 0;
+	path->depth++;
+}
+
+/*
+ * The next child of the deepest node on the path that has one left,
+ * or NULL when the walk is over. The nodes left behind are popped,
+ * so the path ends at the parent of the child returned.
+ */
+static struct tree_node *
+path_next(struct tree_path *path)
+{
+	struct tree_frame *top;
 
-	for (i=0; i < root->nr_children; i++){
-		__print_tree(root->children + i, level + 1);
+	while (path->depth > 0){
+		top = &path->frames[path->depth - 1];
+		if (top->next < top->node->nr_children)
+			return &top->node->children[top->next++];
+		path->depth--;
 	}
+
+	return NULL;
+}
+
+static void
+print_node(struct tree_node *node, unsigned long level)
+{
+	unsigned long i;
+	for (i=0; i<level; i++)
+		printf("\t");
+	printf("%s\n", node->name);
 }
 
 void
 print_tree(struct tree_node *root)
 {
-	__print_tree(root, 0);
+	struct tree_path path = { NULL, 0, 0 };
+	struct tree_node *node;
+
+	if (root == NULL)
+		return;
+
+	print_node(root, 0);
+	path_push(&path, root);
+	while ((node = path_next(&path)) != NULL){
+		print_node(node, path.depth);
+		if (node->nr_children != 0)
+			path_push(&path, node);
+	}
+
+	free(path.frames);
 }
 
-static char *
-read_line(FILE *file, char *buff, size_t buff_size)
-{
-	char *ret;
-	size_t ret_len;
+/*
+ * The tree file, mapped in memory, and the position of the next line
+ */
+struct tree_file {
+	const char *pos;
+	const char *end;
+};
 
-	ret = fgets(buff, buff_size, file);
+/*
+ * All the nodes of the tree, allocated at once;
+ * every node gets its children in consecutive slots.
+ */
+struct tree_arena {
+	struct tree_node *nodes;
+	unsigned long used;
+	unsigned long size;
+};
 
-	/* sanity check */
-	if (ret == NULL){
-		return ret;
-	}
+/*
+ * Return the next line, and its length without the \n in *len,
+ * or NULL at the end of the file.
+ */
+static const char *
+read_line(struct tree_file *file, size_t *len)
+{
+	const char *line = file->pos;
+	const char *nl;
 
-	ret_len = strlen(ret);
-	if (ret_len == buff_size - 1){
-		fprintf(stderr, "line too long: %s\n", buff);
-		exit(1);
-	}
+	if (line >= file->end)
+		return NULL;
 
-	if (ret_len > 0)
-		buff[ret_len - 1] = '\0'; /* remove \n */
+	nl = memchr(line, '\n', file->end - line);
+	if (nl == NULL)
+		nl = file->end;
+	*len = nl - line;
+	file->pos = nl < file->end ? nl + 1 : nl;
 
-	return ret;
+	return line;
 }
 
-static char *
-read_empty_line(FILE *file, char *buff, size_t buff_size)
+static const char *
+read_empty_line(struct tree_file *file)
 {
-	char *ret;
-	ret = read_line(file, buff, buff_size);
-	if (ret != NULL && strlen(ret) != 0){
-		fprintf(stderr, "expecting an empty line: %s", buff);
+	const char *ret;
+	size_t len;
+
+	ret = read_line(file, &len);
+	if (ret != NULL && len != 0){
+		fprintf(stderr, "expecting an empty line: %.*s\n", (int)len, ret);
 		exit(1);
 	}
 
 	return ret;
 }
 
-static char *
-read_non_empty_line(FILE *file, char *buff, size_t buff_size)
+static const char *
+read_non_empty_line(struct tree_file *file, size_t *len)
 {
-	char *ret;
-	ret = read_line(file, buff, buff_size);
+	const char *ret;
+	ret = read_line(file, len);
 
 	if (ret == NULL){
 		fprintf(stderr, "unexpected EOF\n");
 		exit(1);
 	}
 
-	if (strlen(ret) == 0){
+	if (*len == 0){
 		fprintf(stderr, "Unexpected empty line\n");
 		exit(1);
 	}
@@ -86,15 +164,15 @@ read_non_empty_line(FILE *file, char *buff, size_t buff_size)
 	return ret;
 }
 
-static char *
-find_block_start(FILE *file, char *buff, size_t buff_size)
+static const char *
+find_block_start(struct tree_file *file, size_t *len)
 {
-	char *line;
+	const char *line;
 	for (;;){
-		line = read_line(file, buff, buff_size);
+		line = read_line(file, len);
 		if (line == NULL) /* EOF */
 			break;
-		if (strlen(line) == 0 || line[0] == '#')
+		if (*len == 0 || line[0] == '#')
 			continue;  /* comment or empty line */
 		else
 			break;
@@ -104,16 +182,79 @@ find_block_start(FILE *file, char *buff, size_t buff_size)
 }
 
 /*
- * recursively parse tree file, creating nodes
+ * Number of children, as atol() would read it,
+ * without running past the end of the line.
+ */
+static unsigned
+parse_count(const char *line, size_t len)
+{
+	const char *end = line + len;
+	unsigned n = 0;
+
+	while (line < end && (*line == ' ' || *line == '\t'))
+		line++;
+	if (line < end && *line == '+')
+		line++;
+	for (; line < end && *line >= '0' && *line <= '9'; line++)
+		n = n * 10 + (*line - '0');
+
+	return n;
+}
+
+/*
+ * A single scan over the file, to size the arena: every node
+ * but the root is listed as a child in the block of its parent.
+ */
+static unsigned long
+count_nodes(struct tree_file file)
+{
+	const char *line;
+	unsigned long nodes = 1;
+	size_t len;
+
+	while (find_block_start(&file, &len) != NULL){
+		line = read_line(&file, &len);
+		if (line == NULL)
+			break;
+		nodes += parse_count(line, len);
+		/* skip the children */
+		while ((line = read_line(&file, &len)) != NULL && len != 0)
+			;
+	}
+
+	return nodes;
+}
+
+static struct strtab *names;
+
+struct strtab *
+tree_names(void)
+{
+	if (names == NULL)
+		names = strtab_create();
+
+	return names;
+}
+
+static void
+set_name(struct tree_node *node, const char *name, size_t len)
+{
+	node->name_id = strtab_intern(tree_names(), name, len);
+	node->name = strtab_str(names, node->name_id);
+}
+
+/*
+ * parse the block of a node, filling in its children
  */
 static struct tree_node *
-parse_node(FILE *file, struct tree_node *node)
+parse_node(struct tree_file *file, struct tree_arena *arena, struct tree_node *node)
 {
-	char buff[BUFF_SIZE], *name, *num_str;
+	const char *name, *num_str;
+	size_t len;
 	unsigned nr_children;
 	int i;
 
-	name = find_block_start(file, buff, BUFF_SIZE);
+	name = find_block_start(file, &len);
 	if (name == NULL){ /* EOF */
 		 /* empty file, do nothing */
 		if (node == NULL)
@@ -123,68 +264,122 @@ parse_node(FILE *file, struct tree_node *node)
 		exit(1);
 	}
 
-	/* If no node given, allocate one -- this is used for root
-	 * If node is given, check that the names match */
+	/* If no node given, take the first one -- this is used for root
+	 * If node is given, check that the names match: the name was
+	 * interned when its parent's block was read, so that is an id
+	 * compare */
 	if (node == NULL){
-		node = calloc(1, sizeof(struct tree_node));
-		if (node == NULL){
-			fprintf(stderr, "node allocation failed\n");
-			exit(1);
-		}
-		snprintf(node->name, NODE_NAME_SIZE, "%s", name);
-	} else if (strncmp(node->name, name, NODE_NAME_SIZE) != 0){
+		node = &arena->nodes[arena->used++];
+		set_name(node, name, len);
+	} else if (strtab_intern(names, name, len) != node->name_id){
 		fprintf(stderr, "nodes must be placed in a DFS order\n");
-		fprintf(stderr, "expecting: %s and got: %s\n", node->name, name);
+		fprintf(stderr, "expecting: %s and got: %.*s\n", node->name, (int)len, name);
 		exit(1);
 	}
 
 	/* read number of children */
-	num_str = read_non_empty_line(file, buff, BUFF_SIZE);
-	nr_children = node->nr_children = atol(num_str);
+	num_str = read_non_empty_line(file, &len);
+	nr_children = node->nr_children = parse_count(num_str, len);
 
 	/* allocate children */
+	node->children = NULL;
 	if (nr_children != 0){
-		node->children = malloc(sizeof(struct tree_node)*nr_children);
-		if (node->children == NULL){
+		if (nr_children > arena->size - arena->used){
 			fprintf(stderr, "allocate children failed\n");
 			exit(1);
 		}
+		node->children = &arena->nodes[arena->used];
+		arena->used += nr_children;
 	}
 
 	/* read children names */
 	for (i=0; i<nr_children; i++){
-		name = read_non_empty_line(file, buff, BUFF_SIZE);
-		snprintf(node->children[i].name, NODE_NAME_SIZE, "%s", name);
-		//printf("%s\n", node->children[i].name);
+		name = read_non_empty_line(file, &len);
+		set_name(&node->children[i], name, len);
 	}
 
-	read_empty_line(file, buff, BUFF_SIZE);
+	read_empty_line(file);
 
-	/* parse children */
-	for (i=0; i<nr_children; i++){
-		parse_node(file, &node->children[i]);
+	return node;
+}
+
+/*
+ * The blocks are in DFS order: parse the root, then the block of every
+ * child of the deepest node on the path that still has one left.
+ */
+static struct tree_node *
+parse_tree(struct tree_file *file, struct tree_arena *arena)
+{
+	struct tree_path path = { NULL, 0, 0 };
+	struct tree_node *root, *node;
+
+	root = parse_node(file, arena, NULL);
+	if (root == NULL || root->nr_children == 0)
+		return root;
+
+	path_push(&path, root);
+	while ((node = path_next(&path)) != NULL){
+		parse_node(file, arena, node);
+		if (node->nr_children != 0)
+			path_push(&path, node);
 	}
 
-	return node;
+	free(path.frames);
+	return root;
 }
 
 
+/*
+ * The file is mapped and scanned twice: once to count the nodes,
+ * and once to parse it into an array of that many nodes.
+ * The tree is a single allocation, with the root first.
+ */
 struct tree_node *
 get_tree_from_file(const char *filename)
 {
-	FILE *file;
-	assert(BUFF_SIZE >= NODE_NAME_SIZE);
+	int fd;
+	struct stat st;
+	char *map;
+	struct tree_file file;
+	struct tree_arena arena;
 	struct tree_node *root;
 
-	file = fopen(filename, "r");
-	if (file == NULL){
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0){
 		perror(filename);
 		exit(1);
 	}
 
-	root = parse_node(file, NULL);
+	/* empty file, no tree */
+	if (st.st_size == 0){
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED){
+		perror(filename);
+		exit(1);
+	}
+	close(fd);
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	file.pos = map;
+	file.end = map + st.st_size;
+
+	arena.size = count_nodes(file);
+	arena.used = 0;
+	arena.nodes = calloc(arena.size, sizeof(struct tree_node));
+	if (arena.nodes == NULL){
+		fprintf(stderr, "node allocation failed\n");
+		exit(1);
+	}
+
+	root = parse_tree(&file, &arena);
+	if (root == NULL)
+		free(arena.nodes);
 
-	fclose(file);
+	munmap(map, st.st_size);
 
 	return root;
 }
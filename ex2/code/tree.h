@@ -1,15 +1,21 @@
 #ifndef TREE_H
 #define TREE_H
 
+#include "strtab.h"
+
 /******************************************************************************
  * Data structure definitions
  */
 
-#define NODE_NAME_SIZE 16
-/* tree node structure */
+/*
+ * tree node structure;
+ * names of any length are interned in tree_names(), so nodes with
+ * the same name share it, and have the same name_id
+ */
 struct tree_node {
 	unsigned          nr_children;
-	char              name[NODE_NAME_SIZE];
+	unsigned          name_id;
+	const char        *name;
 	struct tree_node  *children;
 };
 
@@ -18,9 +24,15 @@ struct tree_node {
  * Helper Functions
  */
 
-/* returns the root node of the tree defined in a file */
+/*
+ * returns the root node of the tree defined in a file;
+ * all the nodes are a single allocation, freed with free(root)
+ */
 struct tree_node *get_tree_from_file(const char *filename);
 
 void print_tree(struct tree_node *root);
 
+/* the names of the nodes of all trees */
+struct strtab *tree_names(void);
+
 #endif /* TREE_H */
@@ -0,0 +1,178 @@
+/*
+ * arena-test.c
+ *
+ * A program to verify correct operation of the shared memory arena:
+ * processes allocate blocks of random sizes, fill each with a byte
+ * of their own, and check it is still there before freeing it.
+ * A block handed to two processes at once, or one that is not
+ * 16-byte aligned or lies outside the arena, fails the test.
+ * Afterwards the arena is filled up and emptied,
+ * and must then fit as many blocks again.
+ *
+ * Usage: arena-test [processes] [operations per process]
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "proc-common.h"
+#include "shm-arena.h"
+
+#define ARENA_TEST_PROCS 4
+#define ARENA_TEST_OPS 200000
+#define ARENA_TEST_LIVE 64	/* blocks a process holds at once */
+#define ARENA_TEST_MAX_SIZE 4000
+#define ARENA_TEST_SIZE (8 * 1024 * 1024)
+#define ARENA_TEST_FILL 1000	/* block size for the fill-up check */
+
+struct live {
+	unsigned char *ptr;
+	size_t size;
+	unsigned char fill;
+};
+
+void fail(const char *msg)
+{
+	fprintf(stderr, "%ld: %s\n", (long) getpid(), msg);
+	exit(1);
+}
+
+void check_block(struct shm_arena *a, struct live *l)
+{
+	size_t i;
+
+	for (i = 0; i < l->size; i++)
+		if (l->ptr[i] != l->fill)
+			fail("Block overwritten while allocated");
+	shm_arena_free(a, l->ptr);
+	l->ptr = NULL;
+}
+
+void user(struct shm_arena *a, int id, long nops)
+{
+	struct live live[ARENA_TEST_LIVE];
+	unsigned int seed = id + 1;
+	struct live *l;
+	long i;
+
+	memset(live, 0, sizeof(live));
+	for (i = 0; i < nops; i++) {
+		l = &live[rand_r(&seed) % ARENA_TEST_LIVE];
+		if (l->ptr != NULL) {
+			check_block(a, l);
+			continue;
+		}
+
+		/* Mostly small blocks, as in queues and caches */
+		l->size = 1 + rand_r(&seed) % (i % 4 ? 64 : ARENA_TEST_MAX_SIZE);
+		l->fill = id * 64 + i % 64;
+		l->ptr = shm_arena_alloc(a, l->size);
+		if (l->ptr == NULL)
+			fail("Arena exhausted");
+		if ((uintptr_t) l->ptr % 16 != 0 ||
+		    l->ptr < (unsigned char *) a ||
+		    l->ptr + l->size > (unsigned char *) a + a->size)
+			fail("Block misaligned or outside the arena");
+		if (shm_arena_ptr(a, shm_arena_off(a, l->ptr)) != l->ptr)
+			fail("Offset does not map back to the block");
+		memset(l->ptr, l->fill, l->size);
+	}
+
+	for (i = 0; i < ARENA_TEST_LIVE; i++)
+		if (live[i].ptr != NULL)
+			check_block(a, &live[i]);
+	exit(0);
+}
+
+/* Allocate blocks until the arena runs out, free them, return how many */
+long fill_up(struct shm_arena *a)
+{
+	void **blocks;
+	long i, n;
+
+	blocks = malloc(a->size / ARENA_TEST_FILL * sizeof(void *));
+	if (blocks == NULL) {
+		perror("fill_up: malloc");
+		exit(1);
+	}
+	for (n = 0; (blocks[n] = shm_arena_alloc(a, ARENA_TEST_FILL)) != NULL; n++)
+		;
+	for (i = 0; i < n; i++)
+		shm_arena_free(a, blocks[i]);
+	free(blocks);
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, status, ok = 1;
+	int nprocs = ARENA_TEST_PROCS;
+	long nops = ARENA_TEST_OPS, before, after;
+	struct timespec start, end;
+	struct shm_arena *a;
+	pid_t p;
+
+	if (argc > 3 ||
+	    (argc > 1 && (nprocs = atoi(argv[1])) <= 0) ||
+	    (argc > 2 && (nops = atol(argv[2])) <= 0)) {
+		fprintf(stderr, "Usage: %s [processes] [operations per process]\n", argv[0]);
+		exit(1);
+	}
+
+	a = shm_arena_create(ARENA_TEST_SIZE);
+	if (shm_arena_alloc(a, SIZE_MAX - 4) != NULL ||
+	    shm_arena_alloc(a, 1UL << 31) != NULL)
+		fail("Huge allocation did not fail");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nprocs; i++) {
+		p = fork();
+		if (p < 0) {
+			perror("parent: fork");
+			exit(1);
+		}
+		if (p == 0) {
+			user(a, i, nops);
+			assert(0);
+		}
+	}
+	for (i = 0; i < nprocs; i++) {
+		p = wait(&status);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			explain_wait_status(p, status);
+			ok = 0;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (!ok) {
+		printf("Arena test failed.\n");
+		exit(1);
+	}
+
+	/*
+	 * The used part of the arena only grows, so once it is full
+	 * the second round can only be served from the free lists.
+	 */
+	before = fill_up(a);
+	after = fill_up(a);
+	if (before == 0 || after != before) {
+		printf("Arena test failed: %ld blocks fit, then %ld.\n", before, after);
+		exit(1);
+	}
+
+	printf("%d processes, %ld operations each in %.3f s, %ld blocks of %d bytes fit: OK\n",
+	       nprocs, nops,
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+	       before, ARENA_TEST_FILL);
+
+	shm_arena_destroy(a);
+	return 0;
+}
@@ -50,8 +50,7 @@ void proc_B(void)
 	volatile int *n = &shared_memory[0];
 
 	for (;;) {
-        pipesem_wait(&sem[0]);
-        pipesem_wait(&sem[0]);
+        pipesem_wait_n(&sem[0], 2);
 		*n = *n - 2;
         pipesem_signal(&sem[1]);
 	}
@@ -73,8 +72,7 @@ void proc_C(void)
 		if (val != 1) {
 			printf("     ...Aaaaaargh!\n");
 		}
-        pipesem_signal(&sem[2]);
-        pipesem_signal(&sem[2]);
+        pipesem_signal_n(&sem[2], 2);
 	}
 	exit(0);
 }
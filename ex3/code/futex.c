@@ -0,0 +1,102 @@
+/*
+ * futex.c
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "futex.h"
+
+/*
+ * Sleep as long as *addr == val, or until the (relative) timeout expires.
+ * These are not FUTEX_PRIVATE_FLAG operations: the word may be mapped
+ * at different addresses in different processes.
+ *
+ * Returns 0 when woken up, or -1 with errno set to EAGAIN if *addr
+ * was not val to begin with, ETIMEDOUT or EINTR.
+ */
+int futex_wait(volatile int *addr, int val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+/*
+ * Wake up to nr processes sleeping on addr.
+ * Returns the number of processes woken up.
+ */
+int futex_wake(volatile int *addr, int nr)
+{
+    int status;
+
+    status = syscall(SYS_futex, addr, FUTEX_WAKE, nr, NULL, NULL, 0);
+    if (status < 0) {
+        perror("futex_wake");
+    }
+
+    return status;
+}
+
+static int online_cpus(void)
+{
+    static int ncpus = 0;
+
+    if (ncpus == 0)
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return ncpus;
+}
+
+static int clamp_spins(int spins)
+{
+    if (spins < FUTEX_SPIN_MIN)
+        return FUTEX_SPIN_MIN;
+    if (spins > FUTEX_SPIN_MAX)
+        return FUTEX_SPIN_MAX;
+    return spins;
+}
+
+/*
+ * Wait a little for *addr to stop being val, before the caller
+ * goes to sleep on it: spin for up to *budget rounds, then yield
+ * the CPU a few times. Spinning is skipped on a single CPU,
+ * where the process we are waiting for cannot run meanwhile.
+ *
+ * The budget follows the waits we see: it moves towards twice the
+ * rounds a successful spin took, doubles when the wait ended while
+ * yielding, and shrinks when we had to give up.
+ *
+ * Returns 1 if *addr changed, 0 if the caller should sleep.
+ */
+int futex_spin(volatile int *addr, int val, int *budget)
+{
+    int i, spins;
+
+    spins = __atomic_load_n(budget, __ATOMIC_RELAXED);
+    if (online_cpus() == 1)
+        spins = 0;
+
+    for (i = 0; i < spins; i++) {
+        if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != val) {
+            spins += (2 * i - spins) / 8;
+            __atomic_store_n(budget, clamp_spins(spins), __ATOMIC_RELAXED);
+            return 1;
+        }
+        cpu_relax();
+    }
+
+    for (i = 0; i < FUTEX_SPIN_YIELDS; i++) {
+        if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != val) {
+            if (spins > 0)
+                __atomic_store_n(budget, clamp_spins(2 * spins), __ATOMIC_RELAXED);
+            return 1;
+        }
+        sched_yield();
+    }
+
+    if (spins > 0)
+        __atomic_store_n(budget, clamp_spins(spins - spins / 4), __ATOMIC_RELAXED);
+    return 0;
+}
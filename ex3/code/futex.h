@@ -0,0 +1,47 @@
+/*
+ * futex.h
+ *
+ * Thin wrappers around the futex(2) system call,
+ * for synchronization primitives that live in memory
+ * shared between processes.
+ */
+
+#ifndef FUTEX_H__
+#define FUTEX_H__
+
+#include <time.h>
+
+/*
+ * Adaptive spinning before going to sleep.
+ * Every waiting side of a primitive keeps its own spin budget, an int
+ * initialized to FUTEX_SPIN_INIT, which futex_spin() keeps between
+ * FUTEX_SPIN_MIN and FUTEX_SPIN_MAX rounds of cpu_relax().
+ */
+#define FUTEX_SPIN_INIT   128
+#define FUTEX_SPIN_MIN    16
+#define FUTEX_SPIN_MAX    4096
+#define FUTEX_SPIN_YIELDS 4
+
+/*
+ * One round of busy waiting: tell the CPU we are spinning,
+ * so it can save power and give a sibling hyperthread a turn.
+ */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/*
+ * Function prototypes
+ */
+int futex_wait(volatile int *addr, int val, const struct timespec *timeout);
+int futex_wake(volatile int *addr, int nr);
+int futex_spin(volatile int *addr, int val, int *budget);
+
+#endif /* FUTEX_H__ */
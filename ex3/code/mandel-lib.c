@@ -91,6 +91,7 @@ static void maketable()
 		colortable[c][1] = rgb[1];
 		colortable[c][2] = rgb[2];
 	}
+	initialized = 1;
 }
 
 // selects the nearest xterm color for a 3xBYTE rgb value
@@ -416,6 +417,131 @@ int mandel_iterations_at_point(double x, double y, int max)
 	return iter;
 }
 
+/*
+ * This function computes escape times for a batch of n points,
+ * with the same result as calling mandel_iterations_at_point()
+ * for each of them. Point i iterates z = z^2 + c starting from
+ * z = (zx[i], zy[i]) with c = (cx[i], cy[i]): Mandelbrot points
+ * start from z = c, Julia set points share a fixed c.
+ *
+ * Points are iterated MANDEL_BATCH_LANES at a time, in lockstep,
+ * so that the compiler can keep each group in vector registers;
+ * points that have escaped stop changing until the whole group is done.
+ */
+void mandel_iterations_batch(const double zx[], const double zy[],
+                             const double cx[], const double cy[],
+                             int iter[], int n, int max)
+{
+	int i, l, k, lanes, any;
+	double x[MANDEL_BATCH_LANES], y[MANDEL_BATCH_LANES];
+	double x0[MANDEL_BATCH_LANES], y0[MANDEL_BATCH_LANES];
+	int count[MANDEL_BATCH_LANES];
+
+	for (i = 0; i < n; i += MANDEL_BATCH_LANES) {
+		lanes = n - i < MANDEL_BATCH_LANES ? n - i : MANDEL_BATCH_LANES;
+
+		/* Unused lanes of the last group start out escaped */
+		for (l = 0; l < MANDEL_BATCH_LANES; l++) {
+			x[l] = l < lanes ? zx[i + l] : 4;
+			y[l] = l < lanes ? zy[i + l] : 4;
+			x0[l] = l < lanes ? cx[i + l] : 0;
+			y0[l] = l < lanes ? cy[i + l] : 0;
+			count[l] = 0;
+		}
+
+		for (k = 0; k < max; k++) {
+			any = 0;
+			for (l = 0; l < MANDEL_BATCH_LANES; l++) {
+				double xx = x[l] * x[l];
+				double yy = y[l] * y[l];
+				int bounded = xx + yy <= 4;
+				double xt = xx - yy + x0[l];
+				double yt = 2 * x[l] * y[l] + y0[l];
+
+				x[l] = bounded ? xt : x[l];
+				y[l] = bounded ? yt : y[l];
+				count[l] += bounded;
+				any |= bounded;
+			}
+			if (!any)
+				break;
+		}
+
+		for (l = 0; l < lanes; l++)
+			iter[i + l] = count[l];
+	}
+}
+
+/*
+ * Escape radius (squared) used for distance estimation. Iterating
+ * past |z| = 2 makes the estimate accurate; the iteration count
+ * returned is still the one for |z| = 2.
+ */
+#define MANDEL_DE_BAILOUT 1e6
+
+/*
+ * This function takes a (x,y) point on the complex plane
+ * and iterates z alongside its derivative dz with respect to c,
+ * to estimate the distance of the point from the Mandelbrot Set.
+ *
+ * The escape time, as returned by mandel_iterations_at_point(),
+ * is stored in *iter. Points that do not escape within max iterations
+ * are considered part of the set and have a distance of 0.
+ * Points in the main cardioid or the period-2 bulb are detected
+ * up front and do not cost any iterations.
+ */
+double mandel_distance_at_point(double x, double y, int max, int *iter)
+{
+	double x0 = x;
+	double y0 = y;
+	double dx = 1, dy = 0;
+	double m, q;
+	int escaped = -1;
+	int n = 0;
+
+	q = (x0 - 0.25) * (x0 - 0.25) + y0 * y0;
+	if (q * (q + (x0 - 0.25)) <= 0.25 * y0 * y0 ||
+	    (x0 + 1) * (x0 + 1) + y0 * y0 <= 0.0625) {
+		*iter = max;
+		return 0;
+	}
+
+	for (;;) {
+		m = x * x + y * y;
+		if (m > 4 && escaped < 0)
+			escaped = n;
+		if (m > MANDEL_DE_BAILOUT || n >= max)
+			break;
+
+		/* dz' = 2 * z * dz + 1, then z' = z^2 + c */
+		double dxt = 2 * (x * dx - y * dy) + 1;
+		double dyt = 2 * (x * dy + y * dx);
+		double xt = x * x - y * y + x0;
+		double yt = 2 * x * y + y0;
+
+		dx = dxt;
+		dy = dyt;
+		x = xt;
+		y = yt;
+
+		++n;
+	}
+
+	if (escaped < 0) {
+		*iter = max;
+		return 0;
+	}
+
+	*iter = escaped;
+	return 0.5 * log(m) * sqrt(m / (dx * dx + dy * dy));
+}
+
+/*
+ * xterm colors for the 256 palette entries, filled in on first use.
+ */
+static int xterm_palette_ready = 0;
+static unsigned char xterm_palette[256];
+
 /*
  * This function takes a color value as returned
  * by mandelbrot_iterations() and uses the 256-color
@@ -424,18 +550,77 @@ int mandel_iterations_at_point(double x, double y, int max)
  */
 unsigned char xterm_color(int color_val)
 {
+	int i;
 	unsigned char rgb[3];
 
+	/* Look up the palette once, then serve every pixel from the table */
+	if (!xterm_palette_ready) {
+		for (i = 0; i < 256; i++) {
+			rgb[0] = 255.0 * mandel256[i].red;
+			rgb[1] = 255.0 * mandel256[i].green;
+			rgb[2] = 255.0 * mandel256[i].blue;
+			xterm_palette[i] = rgb2xterm(rgb);
+		}
+		xterm_palette_ready = 1;
+	}
+
 	if (color_val > 255)
 		color_val = 255;
 
-	rgb[0] = 255.0 * mandel256[color_val].red;
-	rgb[1] = 255.0 * mandel256[color_val].green;
-	rgb[2] = 255.0 * mandel256[color_val].blue;
-	color_val = rgb2xterm(rgb);
-	
-	assert(0 <= color_val && color_val <= 255);
-	return color_val;
+	assert(0 <= color_val);
+	return xterm_palette[color_val];
+}
+
+/*
+ * These functions color a whole line of n iteration counts at once,
+ * as xterm_color() would color every one of them.
+ */
+void xterm_color_line16(unsigned char color[], const uint16_t iter[], int n)
+{
+	int i;
+
+	xterm_color(0);
+	for (i = 0; i < n; i++)
+		color[i] = xterm_palette[iter[i] < 255 ? iter[i] : 255];
+}
+
+void xterm_color_line32(unsigned char color[], const uint32_t iter[], int n)
+{
+	int i;
+
+	xterm_color(0);
+	for (i = 0; i < n; i++)
+		color[i] = xterm_palette[iter[i] < 255 ? iter[i] : 255];
+}
+
+/*
+ * This function takes an array of n color values, as returned
+ * by mandel_iterations_at_point(), averages the corresponding
+ * palette entries in RGB space and returns the closest
+ * color for 256-color xterms. It is used to anti-alias pixels
+ * that have been sampled more than once.
+ */
+unsigned char xterm_color_blend(const int color_vals[], int n)
+{
+	int i, val;
+	unsigned char rgb[3];
+	double red = 0, green = 0, blue = 0;
+
+	assert(n > 0);
+	for (i = 0; i < n; i++) {
+		val = color_vals[i];
+		if (val > 255)
+			val = 255;
+		red += mandel256[val].red;
+		green += mandel256[val].green;
+		blue += mandel256[val].blue;
+	}
+
+	rgb[0] = 255.0 * red / n;
+	rgb[1] = 255.0 * green / n;
+	rgb[2] = 255.0 * blue / n;
+
+	return rgb2xterm(rgb);
 }
 
 /*
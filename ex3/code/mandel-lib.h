@@ -9,9 +9,21 @@
 #ifndef MANDEL_LIB_H__
 #define MANDEL_LIB_H__
 
+#include <stdint.h>
+
+/* Points iterated together by mandel_iterations_batch() */
+#define MANDEL_BATCH_LANES 8
+
 /* Function prototypes */
 int mandel_iterations_at_point(double x, double y, int max);
+void mandel_iterations_batch(const double zx[], const double zy[],
+                             const double cx[], const double cy[],
+                             int iter[], int n, int max);
+double mandel_distance_at_point(double x, double y, int max, int *iter);
 unsigned char xterm_color(int color_val);
+unsigned char xterm_color_blend(const int color_vals[], int n);
+void xterm_color_line16(unsigned char color[], const uint16_t iter[], int n);
+void xterm_color_line32(unsigned char color[], const uint32_t iter[], int n);
 ssize_t insist_write(int fd, const char *buf, size_t count);
 void set_xterm_color(int fd, unsigned char color);
 void reset_xterm_color(int fd);
@@ -0,0 +1,282 @@
+/*
+ * mandel-sweep.c
+ *
+ * A program to render many small pictures of the Mandelbrot Set
+ * and of Julia sets as a single batched job.
+ *
+ * The list of pictures is read from standard input, one per line:
+ *
+ *     mandel xmin xmax ymin ymax
+ *     julia cx cy xmin xmax ymin ymax
+ *     julia-grid cx0 cx1 ncx cy0 cy1 ncy xmin xmax ymin ymax
+ *
+ * The last form is a grid of ncx x ncy Julia sets, for c ranging
+ * from (cx0, cy0) to (cx1, cy1). Empty lines and lines starting
+ * with '#' are ignored.
+ *
+ * The points of all pictures are laid out one after the other and
+ * cut into chunks of MANDEL_SWEEP_CHUNK points, regardless of which
+ * picture they belong to. Worker processes grab chunks through a counter
+ * in shared memory and iterate them with mandel_iterations_batch(),
+ * so small pictures do not leave workers or vector lanes idle.
+ * Escape times are written straight into a shared result area.
+ *
+ * Every picture is output as a binary PGM, with gray level
+ * min(iterations, 255): either to a file per picture, or
+ * one after the other on standard output.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "mandel-lib.h"
+#include "proc-common.h"
+
+#define NCHILDREN 4
+#define MANDEL_SWEEP_CHUNK 4096
+#define MANDEL_SWEEP_LINE 1024
+
+struct sweep_job {
+    int julia;
+    double cx, cy;              /* Julia set parameter */
+    double xmin, xmax, ymin, ymax;
+};
+
+struct sweep_job *jobs = NULL;
+int njobs = 0;
+int jobs_size = 0;
+
+int width = 32;
+int height = 32;
+int max_iteration = 256;
+int nworkers = NCHILDREN;
+
+void add_job(int julia, double cx, double cy,
+             double xmin, double xmax, double ymin, double ymax)
+{
+    if (njobs == jobs_size) {
+        jobs_size = jobs_size ? 2 * jobs_size : 256;
+        jobs = realloc(jobs, jobs_size * sizeof(struct sweep_job));
+        if (jobs == NULL) {
+            perror("add_job: realloc");
+            exit(1);
+        }
+    }
+    jobs[njobs].julia = julia;
+    jobs[njobs].cx = cx;
+    jobs[njobs].cy = cy;
+    jobs[njobs].xmin = xmin;
+    jobs[njobs].xmax = xmax;
+    jobs[njobs].ymin = ymin;
+    jobs[njobs].ymax = ymax;
+    njobs++;
+}
+
+void read_jobs(FILE *file)
+{
+    char buf[MANDEL_SWEEP_LINE];
+    char kind[16];
+    int lineno = 0;
+    int i, j, ncx, ncy;
+    double cx, cy, cx1, cy1, xmin, xmax, ymin, ymax;
+
+    while (fgets(buf, sizeof(buf), file) != NULL) {
+        lineno++;
+        if (sscanf(buf, "%15s", kind) != 1 || kind[0] == '#')
+            continue;
+
+        if (strcmp(kind, "mandel") == 0 &&
+            sscanf(buf, "%*s %lf %lf %lf %lf", &xmin, &xmax, &ymin, &ymax) == 4) {
+            add_job(0, 0, 0, xmin, xmax, ymin, ymax);
+        } else if (strcmp(kind, "julia") == 0 &&
+            sscanf(buf, "%*s %lf %lf %lf %lf %lf %lf",
+                   &cx, &cy, &xmin, &xmax, &ymin, &ymax) == 6) {
+            add_job(1, cx, cy, xmin, xmax, ymin, ymax);
+        } else if (strcmp(kind, "julia-grid") == 0 &&
+            sscanf(buf, "%*s %lf %lf %d %lf %lf %d %lf %lf %lf %lf",
+                   &cx, &cx1, &ncx, &cy, &cy1, &ncy,
+                   &xmin, &xmax, &ymin, &ymax) == 10 && ncx > 0 && ncy > 0) {
+            for (i = 0; i < ncy; i++) {
+                for (j = 0; j < ncx; j++) {
+                    add_job(1,
+                        ncx > 1 ? cx + (cx1 - cx) * j / (ncx - 1) : cx,
+                        ncy > 1 ? cy + (cy1 - cy) * i / (ncy - 1) : cy,
+                        xmin, xmax, ymin, ymax);
+                }
+            }
+        } else {
+            fprintf(stderr, "line %d: cannot parse: %s", lineno, buf);
+            exit(1);
+        }
+    }
+}
+
+/*
+ * Compute the escape times of points [first, first + n)
+ * of the whole sweep, and store them in result[].
+ */
+void compute_chunk(long first, int n, unsigned char result[])
+{
+    static double zx[MANDEL_SWEEP_CHUNK], zy[MANDEL_SWEEP_CHUNK];
+    static double cx[MANDEL_SWEEP_CHUNK], cy[MANDEL_SWEEP_CHUNK];
+    static int iter[MANDEL_SWEEP_CHUNK];
+    long point, picture = (long) width * height;
+    struct sweep_job *job;
+    int i, pixel;
+
+    for (i = 0; i < n; i++) {
+        point = first + i;
+        job = &jobs[point / picture];
+        pixel = point % picture;
+
+        /* Same points as mandel would draw for this picture */
+        zx[i] = job->xmin + (job->xmax - job->xmin) / width * (pixel % width);
+        zy[i] = job->ymax - (job->ymax - job->ymin) / height * (pixel / width);
+        cx[i] = job->julia ? job->cx : zx[i];
+        cy[i] = job->julia ? job->cy : zy[i];
+    }
+
+    mandel_iterations_batch(zx, zy, cx, cy, iter, n, max_iteration);
+
+    for (i = 0; i < n; i++)
+        result[first + i] = iter[i] < 255 ? iter[i] : 255;
+}
+
+/*
+ * Grab chunks until there are none left.
+ */
+void worker(volatile long *next_chunk, long npoints, unsigned char result[])
+{
+    long first;
+
+    for (;;) {
+        first = __atomic_fetch_add(next_chunk, MANDEL_SWEEP_CHUNK, __ATOMIC_RELAXED);
+        if (first >= npoints)
+            return;
+        compute_chunk(first, npoints - first < MANDEL_SWEEP_CHUNK ?
+                      npoints - first : MANDEL_SWEEP_CHUNK, result);
+    }
+}
+
+void write_pgm(FILE *file, const unsigned char pixels[])
+{
+    fprintf(file, "P5\n%d %d\n255\n", width, height);
+    if (fwrite(pixels, 1, (size_t) width * height, file) != (size_t) width * height) {
+        perror("write_pgm: fwrite");
+        exit(1);
+    }
+}
+
+void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-s WIDTHxHEIGHT] [-i max_iteration] [-w workers] [-o dir] < jobs\n\n"
+        "  -s  size of every picture (default 32x32)\n"
+        "  -i  iteration budget per point (default 256)\n"
+        "  -w  number of worker processes\n"
+        "  -o  write picture N to dir/N.pgm instead of standard output\n", argv0);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, opt, status;
+    long npoints, picture;
+    char path[MANDEL_SWEEP_LINE];
+    const char *dir = NULL;
+    volatile long *next_chunk;
+    unsigned char *result;
+    pid_t p;
+    FILE *file;
+
+    while ((opt = getopt(argc, argv, "s:i:w:o:")) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2 ||
+                    width <= 0 || height <= 0)
+                    usage(argv[0]);
+                break;
+            case 'i':
+                max_iteration = atoi(optarg);
+                if (max_iteration <= 0)
+                    usage(argv[0]);
+                break;
+            case 'w':
+                nworkers = atoi(optarg);
+                if (nworkers <= 0)
+                    usage(argv[0]);
+                break;
+            case 'o':
+                dir = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+    }
+
+    read_jobs(stdin);
+    if (njobs == 0)
+        return 0;
+
+    picture = (long) width * height;
+    if (picture > LONG_MAX / njobs) {
+        fprintf(stderr, "%s: %d pictures of %dx%d do not fit in memory\n",
+            argv[0], njobs, width, height);
+        exit(1);
+    }
+    npoints = picture * njobs;
+    next_chunk = create_shared_memory_area(sizeof(long));
+    /* Workers should not take page faults in the middle of a sweep */
+    result = create_shared_memory_area_flags(npoints,
+        SHM_AREA_HUGETLB | SHM_AREA_POPULATE);
+    *next_chunk = 0;
+
+    for (i = 0; i < nworkers; i++) {
+        p = fork();
+        if (p < 0) {
+            perror("fork");
+            exit(1);
+        }
+        if (p == 0) {
+            worker(next_chunk, npoints, result);
+            exit(0);
+        }
+    }
+
+    /* Every point gets computed only if every worker is fine */
+    for (i = 0; i < nworkers; i++) {
+        p = wait(&status);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            explain_wait_status(p, status);
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < njobs; i++) {
+        if (dir == NULL) {
+            write_pgm(stdout, result + i * picture);
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%05d.pgm", dir, i);
+        file = fopen(path, "w");
+        if (file == NULL) {
+            perror(path);
+            exit(1);
+        }
+        write_pgm(file, result + i * picture);
+        fclose(file);
+    }
+
+    destroy_shared_memory_area(result, npoints);
+    destroy_shared_memory_area((void *) next_chunk, sizeof(long));
+    return 0;
+}
@@ -11,13 +11,79 @@
 #include <string.h>
 #include <math.h>
 #include <stdlib.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include "mandel-lib.h"
-#include "pipesem.h"
 
 #define MANDEL_MAX_ITERATION 100000
 #define NCHILDREN 1
 
+/*
+ * Straggler mitigation: a line that has been computed for longer than
+ * MANDEL_STRAGGLER_FACTOR times the average line time (and at least
+ * MANDEL_STRAGGLER_MIN seconds) is handed to an idle worker as well,
+ * up to MANDEL_MAX_COPIES copies in flight. Whichever copy comes back
+ * first is used.
+ */
+#define MANDEL_STRAGGLER_FACTOR 4
+#define MANDEL_STRAGGLER_MIN 0.05
+#define MANDEL_MAX_COPIES 2
+
+/*
+ * A worker that has been on a line for MANDEL_STALL_FACTOR times the
+ * average line time (and at least MANDEL_STALL_MIN seconds) is taken
+ * to be stuck, even with no idle worker to race it: it is killed and
+ * replaced, and its line is handed out again. The allowance of a line
+ * doubles every time this happens to it, so a line that is just slow
+ * still gets done.
+ */
+#define MANDEL_STALL_FACTOR 32
+#define MANDEL_STALL_MIN 2.0
+#define MANDEL_MAX_STALLS 8
+
+/*
+ * Anti-aliasing: pixels whose iteration count differs from one of
+ * their neighbours' by more than MANDEL_AA_THRESHOLD are resampled on
+ * a MANDEL_AA_GRID x MANDEL_AA_GRID grid of subpixel points.
+ */
+#define MANDEL_AA_GRID 4
+#define MANDEL_AA_THRESHOLD 2
+
+/*
+ * Workers anti-alias runs of consecutive lines, and every run costs
+ * the iteration counts of the lines around it once more. A run that
+ * a worker is going through is split with an idle worker only if it
+ * still has MANDEL_AA_MIN_SPLIT lines or more.
+ */
+#define MANDEL_AA_MIN_SPLIT 8
+
+/*
+ * Automatic iteration budget (-i auto): start from an estimate based on
+ * the pixel size, then keep doubling it while more than
+ * MANDEL_AUTO_LATE_RATIO of the probe points that were still bounded
+ * escape within twice the budget. Colors saturate at 255 iterations,
+ * so a budget below MANDEL_AUTO_MIN_ITERATION never pays off.
+ */
+#define MANDEL_AUTO_MIN_ITERATION 256
+#define MANDEL_AUTO_PROBE 64
+#define MANDEL_AUTO_LATE_RATIO 0.01
+
+/*
+ * Distance estimation (-d, -b): escaping points closer to the set than
+ * MANDEL_DE_PIXELS character widths are on its boundary. In boundary
+ * mode they are drawn with color value MANDEL_BOUNDARY_COLOR on a
+ * background of color value 255.
+ */
+#define MANDEL_DE_PIXELS 0.5
+#define MANDEL_BOUNDARY_COLOR 7
+
 /***************************
  * Compile-time parameters *
  ***************************/
@@ -43,33 +109,268 @@ double xstep;
 double ystep;
 
 /*
- * This function computes a line of output
- * as an array of x_char color values.
+ * Set with -a: only pixels on a color boundary get supersampled.
  */
-void compute_mandel_line(int line, int color_val[])
+int antialias = 0;
+
+/*
+ * Iteration budget for every point, set with -i.
+ */
+int max_iteration = MANDEL_MAX_ITERATION;
+
+/*
+ * What workers send to the parent for every point (-t): its xterm color
+ * in a byte, or its iteration count in 16 or 32 bits, to be colored
+ * by the parent.
+ */
+enum { TRANSPORT_U8, TRANSPORT_U16, TRANSPORT_U32 } transport = TRANSPORT_U8;
+
+/*
+ * How distance estimation is used:
+ * not at all, to draw thin filaments of the set (-d),
+ * or to draw only the boundary of the set (-b).
+ */
+enum { DE_NONE, DE_FILAMENTS, DE_BOUNDARY } distance_mode = DE_NONE;
+
+/*
+ * This function returns the color value for a single point
+ * of the complex plane, according to the current distance mode.
+ */
+int iterations_at_point(double x, double y)
 {
-    /*
-     * x and y traverse the complex plane.
-     */
-    double x, y;
+    int iter;
+    int near;
+    double dist, pixel;
+
+    if (distance_mode == DE_NONE)
+        return mandel_iterations_at_point(x, y, max_iteration);
 
+    dist = mandel_distance_at_point(x, y, max_iteration, &iter);
+    pixel = xstep > ystep ? xstep : ystep;
+    near = iter < max_iteration && dist < MANDEL_DE_PIXELS * pixel;
+
+    if (distance_mode == DE_BOUNDARY)
+        return near ? MANDEL_BOUNDARY_COLOR : 255;
+
+    /* A filament thinner than a pixel still colors it as part of the set */
+    return near ? 255 : iter;
+}
+
+/*
+ * This function computes the iteration counts
+ * for the x_chars points of a line.
+ */
+void compute_iteration_line(int line, int iter[])
+{
+    static double *xs = NULL, *ys = NULL;
+    double x, y;
     int n;
-    int val;
 
     /* Find out the y value corresponding to this line */
     y = ymax - ystep * line;
 
+    /* Plain escape times: iterate the whole line as a batch */
+    if (distance_mode == DE_NONE) {
+        if (xs == NULL) {
+            xs = malloc(x_chars * sizeof(double));
+            ys = malloc(x_chars * sizeof(double));
+            if (xs == NULL || ys == NULL) {
+                perror("compute_iteration_line: malloc");
+                exit(1);
+            }
+        }
+        for (n = 0; n < x_chars; n++) {
+            xs[n] = xmin + xstep * n;
+            ys[n] = y;
+        }
+        mandel_iterations_batch(xs, ys, xs, ys, iter, x_chars, max_iteration);
+        return;
+    }
+
     /* and iterate for all points on this line */
-    for (x = xmin, n = 0; x <= xmax; x+= xstep, n++) {
+    for (n = 0; n < x_chars; n++) {
+        x = xmin + xstep * n;
+        iter[n] = iterations_at_point(x, y);
+    }
+}
+
+/*
+ * Iteration counts of the most recently computed lines.
+ * Anti-aliasing line N needs lines N - 1 and N + 1 as well,
+ * so a worker drawing consecutive lines computes each of them once;
+ * the parent hands out runs of consecutive lines for this.
+ * Line N is kept in slot N % 3: the three lines of one call always
+ * have slots of their own, whatever order lines are handed out in.
+ */
+#define AA_CACHED_LINES 3
+
+static struct {
+    int line;
+    int *iter;
+} aa_cache[AA_CACHED_LINES];
+
+static int *cached_iteration_line(int line)
+{
+    int i = line % AA_CACHED_LINES;
+
+    if (aa_cache[i].iter == NULL) {
+        aa_cache[i].iter = malloc(x_chars * sizeof(int));
+        if (aa_cache[i].iter == NULL) {
+            perror("cached_iteration_line: malloc");
+            exit(1);
+        }
+    } else if (aa_cache[i].line == line) {
+        return aa_cache[i].iter;
+    }
+    aa_cache[i].line = line;
+    compute_iteration_line(line, aa_cache[i].iter);
+
+    return aa_cache[i].iter;
+}
+
+/*
+ * Is the difference between two iteration counts
+ * large enough to be an edge? Counts past the end
+ * of the palette all get the same color.
+ */
+static int is_edge(int a, int b)
+{
+    if (a > 255)
+        a = 255;
+    if (b > 255)
+        b = 255;
+    return abs(a - b) > MANDEL_AA_THRESHOLD;
+}
+
+/*
+ * This function computes an anti-aliased line of output.
+ * Every pixel is sampled once; only the pixels that differ
+ * from a neighbour are then sampled MANDEL_AA_GRID^2 more times
+ * and get the average color of all their samples.
+ */
+void compute_mandel_line_aa(int line, int color_val[])
+{
+    int n, i, j, edge;
+    int *above, *cur, *below;
+    int samples[MANDEL_AA_GRID * MANDEL_AA_GRID + 1];
+    double x, y;
+
+    below = line + 1 < y_chars ? cached_iteration_line(line + 1) : NULL;
+    above = line > 0 ? cached_iteration_line(line - 1) : NULL;
+    cur = cached_iteration_line(line);
+
+    y = ymax - ystep * line;
+    for (n = 0; n < x_chars; n++) {
+        edge = (n > 0 && is_edge(cur[n], cur[n - 1])) ||
+               (n + 1 < x_chars && is_edge(cur[n], cur[n + 1])) ||
+               (above && is_edge(cur[n], above[n])) ||
+               (below && is_edge(cur[n], below[n]));
+        if (!edge) {
+            color_val[n] = xterm_color(cur[n]);
+            continue;
+        }
+
+        /*
+         * The pixel covers [x, x + xstep) x (y - ystep, y];
+         * sample the centers of a regular grid of subpixels.
+         */
+        x = xmin + xstep * n;
+        samples[0] = cur[n];
+        for (i = 0; i < MANDEL_AA_GRID; i++) {
+            for (j = 0; j < MANDEL_AA_GRID; j++) {
+                samples[1 + i * MANDEL_AA_GRID + j] = iterations_at_point(
+                    x + xstep * (j + 0.5) / MANDEL_AA_GRID,
+                    y - ystep * (i + 0.5) / MANDEL_AA_GRID);
+            }
+        }
+        color_val[n] = xterm_color_blend(samples, MANDEL_AA_GRID * MANDEL_AA_GRID + 1);
+    }
+}
 
-        /* Compute the point's color value */
-        val = mandel_iterations_at_point(x, y, MANDEL_MAX_ITERATION);
-        if (val > 255)
-            val = 255;
+/*
+ * This function computes a line of output
+ * as an array of x_char color values.
+ */
+void compute_mandel_line(int line, int color_val[])
+{
+    int n;
 
+    if (antialias) {
+        compute_mandel_line_aa(line, color_val);
+        return;
+    }
+
+    compute_iteration_line(line, color_val);
+    for (n = 0; n < x_chars; n++) {
         /* And store it in the color_val[] array */
-        val = xterm_color(val);
-        color_val[n] = val;
+        color_val[n] = xterm_color(color_val[n]);
+    }
+}
+
+/*
+ * Size of a packed line, as sent by a worker.
+ */
+size_t payload_size(void)
+{
+    switch (transport) {
+        case TRANSPORT_U16:
+            return x_chars * sizeof(uint16_t);
+        case TRANSPORT_U32:
+            return x_chars * sizeof(uint32_t);
+        default:
+            return x_chars * sizeof(uint8_t);
+    }
+}
+
+/*
+ * Compute a line and pack it in the transport format.
+ */
+void pack_mandel_line(int line, void *payload)
+{
+    static int *line_buf = NULL;
+    int n;
+
+    if (line_buf == NULL) {
+        line_buf = malloc(x_chars * sizeof(int));
+        if (line_buf == NULL) {
+            perror("pack_mandel_line: malloc");
+            exit(1);
+        }
+    }
+
+    switch (transport) {
+        case TRANSPORT_U16:
+            compute_iteration_line(line, line_buf);
+            for (n = 0; n < x_chars; n++)
+                ((uint16_t *) payload)[n] = line_buf[n] < UINT16_MAX ? line_buf[n] : UINT16_MAX;
+            break;
+        case TRANSPORT_U32:
+            compute_iteration_line(line, line_buf);
+            for (n = 0; n < x_chars; n++)
+                ((uint32_t *) payload)[n] = line_buf[n];
+            break;
+        default:
+            compute_mandel_line(line, line_buf);
+            for (n = 0; n < x_chars; n++)
+                ((uint8_t *) payload)[n] = line_buf[n];
+    }
+}
+
+/*
+ * Turn a packed line into x_chars color values.
+ * Iteration counts are colored here, a whole line at a time.
+ */
+void unpack_mandel_line(const void *payload, unsigned char color_val[])
+{
+    switch (transport) {
+        case TRANSPORT_U16:
+            xterm_color_line16(color_val, payload, x_chars);
+            break;
+        case TRANSPORT_U32:
+            xterm_color_line32(color_val, payload, x_chars);
+            break;
+        default:
+            memcpy(color_val, payload, x_chars);
     }
 }
 
@@ -77,7 +378,7 @@ void compute_mandel_line(int line, int color_val[])
  * This function outputs an array of x_char color values
  * to a 256-color xterm.
  */
-void output_mandel_line(int fd, int color_val[])
+void output_mandel_line(int fd, unsigned char color_val[])
 {
     int i;
     
@@ -105,79 +406,687 @@ void compute_and_output_mandel_line(int fd, int line)
     /*
      * A temporary array, used to hold color values for the line being drawn
      */
-    int color_val[x_chars];
+    unsigned char color_val[x_chars];
+    char payload[payload_size()];
 
-    compute_mandel_line(line, color_val);
+    pack_mandel_line(line, payload);
+    unpack_mandel_line(payload, color_val);
     output_mandel_line(fd, color_val);
 }
 
-int main(void)
+/*
+ * Pick an iteration budget for the current view.
+ *
+ * The initial guess grows with the zoom level, i.e. with the
+ * number of pixel widths that fit in the interesting [-2, 2] range.
+ * A MANDEL_AUTO_PROBE x MANDEL_AUTO_PROBE grid of probe points is then
+ * iterated for twice the budget: if many of the points that looked bounded
+ * escape in the second half, the budget is too small and gets doubled.
+ */
+int auto_max_iteration(void)
+{
+    int i, j, iter, budget;
+    int bounded, late;
+    double x, y, zoom;
+
+    zoom = 4.0 / (xstep < ystep ? xstep : ystep);
+    budget = 50 * pow(log10(zoom > 10 ? zoom : 10), 1.25);
+    if (budget < MANDEL_AUTO_MIN_ITERATION)
+        budget = MANDEL_AUTO_MIN_ITERATION;
+
+    while (budget < MANDEL_MAX_ITERATION) {
+        bounded = late = 0;
+        for (i = 0; i < MANDEL_AUTO_PROBE; i++) {
+            y = ymax - (ymax - ymin) * (i + 0.5) / MANDEL_AUTO_PROBE;
+            for (j = 0; j < MANDEL_AUTO_PROBE; j++) {
+                x = xmin + (xmax - xmin) * (j + 0.5) / MANDEL_AUTO_PROBE;
+                iter = mandel_iterations_at_point(x, y, 2 * budget);
+                if (iter >= budget) {
+                    bounded++;
+                    if (iter < 2 * budget)
+                        late++;
+                }
+            }
+        }
+        if (late <= MANDEL_AUTO_LATE_RATIO * bounded)
+            break;
+        budget *= 2;
+    }
+
+    return budget < MANDEL_MAX_ITERATION ? budget : MANDEL_MAX_ITERATION;
+}
+
+/*
+ * Read exactly count bytes, unless EOF comes first.
+ * Returns the number of bytes read, or -1 on error.
+ */
+ssize_t insist_read(int fd, void *buf, size_t count)
+{
+    ssize_t ret;
+    size_t done = 0;
+
+    while (done < count) {
+        ret = read(fd, (char *) buf + done, count - done);
+        if (ret < 0)
+            return ret;
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+
+    return done;
+}
+
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Messages from workers to the parent are the line number,
+ * followed by the packed line.
+ */
+size_t message_size(void)
+{
+    return sizeof(int) + payload_size();
+}
+
+/*
+ * A worker computes the lines it is told to through cmd_fd,
+ * and sends each back through res_fd prefixed with its line number.
+ * It exits when the parent closes cmd_fd.
+ */
+void worker(int cmd_fd, int res_fd)
 {
     int line;
-    int buffer[x_chars];
-    struct pipesem sems[NCHILDREN];
-    int pipes[NCHILDREN][2];
+    char *msg;
+    size_t msg_size = message_size();
+    ssize_t status;
 
-    xstep = (xmax - xmin) / x_chars;
-    ystep = (ymax - ymin) / y_chars;
+    msg = malloc(msg_size);
+    if (msg == NULL) {
+        perror("worker: malloc");
+        exit(1);
+    }
+
+    for (;;) {
+        status = insist_read(cmd_fd, &line, sizeof(line));
+        if (status < 0) {
+            perror("worker: read");
+            exit(1);
+        }
+        if (status != sizeof(line))
+            exit(0);
+
+        memcpy(msg, &line, sizeof(line));
+        pack_mandel_line(line, msg + sizeof(line));
+        if (insist_write(res_fd, msg, msg_size) != msg_size) {
+            perror("worker: write");
+            exit(1);
+        }
+    }
+}
+
+/*
+ * The parent's view of a worker process.
+ */
+struct worker {
+    pid_t pid;
+    int alive;
+    int cmd_fd;         /* line numbers go here */
+    int res_fd;         /* computed lines come back here */
+    int line;           /* line being computed, -1 if idle */
+    int last_line;      /* line handed out most recently, -1 if none */
+    double started;     /* when that line was handed out */
+    char *rbuf;         /* result being received */
+    size_t rlen;        /* bytes of it received so far */
+};
+
+/*
+ * The parent's view of a line of output.
+ */
+struct line_state {
+    int done;
+    int copies;         /* workers currently computing it */
+    double issued;      /* when the first of them got it */
+    int stalls;         /* workers killed for being stuck on it */
+};
+
+struct worker *workers;
+int nworkers = NCHILDREN;
+struct line_state *lines;
+unsigned char *frame;
+
+/* Average time it took a worker to compute a line */
+double line_time_sum = 0;
+int line_time_count = 0;
+
+double straggler_deadline(void)
+{
+    double deadline = MANDEL_STRAGGLER_MIN;
+
+    if (line_time_count > 0 &&
+        MANDEL_STRAGGLER_FACTOR * line_time_sum / line_time_count > deadline)
+        deadline = MANDEL_STRAGGLER_FACTOR * line_time_sum / line_time_count;
+
+    return deadline;
+}
+
+/*
+ * How long w may stay on its line before it is taken to be stuck.
+ */
+double stall_deadline(struct worker *w)
+{
+    double deadline = MANDEL_STALL_MIN;
+    int stalls = lines[w->line].stalls;
+
+    if (line_time_count > 0 &&
+        MANDEL_STALL_FACTOR * line_time_sum / line_time_count > deadline)
+        deadline = MANDEL_STALL_FACTOR * line_time_sum / line_time_count;
+
+    return deadline * (1 << (stalls < MANDEL_MAX_STALLS ? stalls : MANDEL_MAX_STALLS));
+}
+
+/*
+ * Start the worker process of slot w.
+ */
+void spawn_worker(struct worker *w)
+{
+    int j;
+    int cmd[2], res[2];
+
+    if (pipe(cmd) < 0 || pipe(res) < 0) {
+        perror("spawn_worker: pipe");
+        exit(1);
+    }
+    w->pid = fork();
+    if (w->pid < 0) {
+        perror("spawn_worker: fork");
+        exit(1);
+    }
+    if (w->pid == 0) {
+        /* Do not keep the other workers' pipes open */
+        for (j = 0; j < nworkers; j++) {
+            if (workers[j].alive) {
+                close(workers[j].cmd_fd);
+                close(workers[j].res_fd);
+            }
+        }
+        close(cmd[1]);
+        close(res[0]);
+        worker(cmd[0], res[1]);
+        exit(0);
+    }
+    close(cmd[0]);
+    close(res[1]);
+    fcntl(res[0], F_SETFL, O_NONBLOCK);
+
+    w->alive = 1;
+    w->cmd_fd = cmd[1];
+    w->res_fd = res[0];
+    w->line = -1;
+    w->last_line = -1;
+    w->rlen = 0;
+    if (w->rbuf == NULL) {
+        w->rbuf = malloc(message_size());
+        if (w->rbuf == NULL) {
+            perror("spawn_worker: malloc");
+            exit(1);
+        }
+    }
+}
+
+void spawn_workers(void)
+{
+    int i;
+
+    workers = calloc(nworkers, sizeof(struct worker));
+    if (workers == NULL) {
+        perror("spawn_workers: calloc");
+        exit(1);
+    }
+
+    for (i = 0; i < nworkers; i++)
+        spawn_worker(&workers[i]);
+}
+
+/*
+ * Kill and reap a worker, and put the line
+ * it was computing back in the pending set.
+ */
+void reap_worker(struct worker *w)
+{
+    int status;
+
+    kill(w->pid, SIGKILL);
+    waitpid(w->pid, &status, 0);
+    close(w->cmd_fd);
+    close(w->res_fd);
+    w->alive = 0;
+
+    if (w->line >= 0)
+        lines[w->line].copies--;
+    w->line = -1;
+}
+
+/*
+ * A worker has exited or crashed.
+ */
+void worker_died(struct worker *w)
+{
+    fprintf(stderr, "mandel: worker %ld died", (long) w->pid);
+    if (w->line >= 0)
+        fprintf(stderr, ", reassigning line %d", w->line);
+    fprintf(stderr, "\n");
+    reap_worker(w);
+}
+
+/*
+ * Kill and replace the workers that are stuck on their line;
+ * lines nobody else has done are handed out again.
+ */
+void restart_stalled(double t)
+{
+    int i;
+    struct worker *w;
+
+    for (i = 0; i < nworkers; i++) {
+        w = &workers[i];
+        if (!w->alive || w->line < 0 || t - w->started <= stall_deadline(w))
+            continue;
+
+        fprintf(stderr, "mandel: worker %ld stuck for %.1f s, replacing it\n",
+            (long) w->pid, t - w->started);
+        if (!lines[w->line].done)
+            lines[w->line].stalls++;
+        reap_worker(w);
+        spawn_worker(w);
+    }
+}
+
+/*
+ * Is some live worker going to go on to this line,
+ * as the one after the line it was handed last?
+ */
+int line_claimed(int line)
+{
+    int i;
+
+    for (i = 0; i < nworkers; i++) {
+        if (workers[i].alive && line > 0 && workers[i].last_line == line - 1)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * With anti-aliasing, a line needs the iteration counts of the lines
+ * above and below it, which a worker only has at hand for the lines
+ * next to the one it did last. So w keeps going down the frame while
+ * the next line is free; otherwise it takes the longest run of lines
+ * nobody has touched, from its start if no other worker is about to
+ * go on into it, or else from its middle, leaving that worker the
+ * first half.
+ * Returns -1 if there is no such line, or no run worth splitting.
+ */
+int next_aa_line(struct worker *w, int first)
+{
+    int line, start = -1, len = 0, best = -1, best_len = 0;
+
+    line = w->last_line + 1;
+    if (w->last_line >= 0 && line < y_chars &&
+        !lines[line].done && lines[line].copies == 0)
+        return line;
+
+    for (line = first; line <= y_chars; line++) {
+        if (line < y_chars && !lines[line].done && lines[line].copies == 0) {
+            if (len++ == 0)
+                start = line;
+            continue;
+        }
+        if (len > best_len) {
+            best = start;
+            best_len = len;
+        }
+        len = 0;
+    }
+
+    if (best >= 0 && line_claimed(best)) {
+        if (best_len < MANDEL_AA_MIN_SPLIT)
+            return -1;
+        best += best_len / 2;
+    }
+    return best;
+}
 
-    int pids[NCHILDREN];
-    int i,j;
-    for (i = 0; i < NCHILDREN; i++) {
-        pipe(pipes[i]);
-        pipesem_init(&sems[i], 0);
-        pids[i] = fork();
-        if (pids[i] < 0) {
-            perror("Failed to fork");
-            return 0;
-        }
-        else if (pids[i] == 0) {
-            close(pipes[i][0]);
-
-            for (j = i; j < y_chars; j += NCHILDREN) {
-                compute_mandel_line(j, buffer);
-                int status;
-                int bytes_written = 0;
-                //printf( "Process %d. Computing line %d\n", i, j );
-                while (bytes_written < x_chars * sizeof(int)) {
-                    status = write(pipes[i][1], (void*) buffer + bytes_written, x_chars * sizeof(int) - bytes_written);
-                    if (status < 0) {
-                        perror("Could not write to pipe");
-                        //TODO Inform your mama
-                        return 0;
-                    }
-                    bytes_written += status;
+/*
+ * Pick the line idle worker w should compute next:
+ * the first line nobody is working on (with anti-aliasing, the
+ * one next_aa_line() picks), or else the line that has been
+ * running the longest past its deadline.
+ * Returns -1 if there is nothing worth doing.
+ */
+int next_line(struct worker *w, int first, double t)
+{
+    int line;
+    int straggler = -1;
+    double deadline = straggler_deadline();
+
+    if (antialias && (line = next_aa_line(w, first)) >= 0)
+        return line;
+
+    for (line = first; line < y_chars; line++) {
+        if (lines[line].done)
+            continue;
+        if (lines[line].copies == 0) {
+            if (!antialias)
+                return line;
+            continue;
+        }
+        if (lines[line].copies < MANDEL_MAX_COPIES &&
+            t - lines[line].issued > deadline &&
+            (straggler < 0 || lines[line].issued < lines[straggler].issued))
+            straggler = line;
+    }
+
+    return straggler;
+}
+
+void assign_line(struct worker *w, int line, double t)
+{
+    if (insist_write(w->cmd_fd, (char *) &line, sizeof(line)) != sizeof(line)) {
+        /* EPIPE: the worker is gone */
+        worker_died(w);
+        return;
+    }
+    if (lines[line].copies == 0)
+        lines[line].issued = t;
+    lines[line].copies++;
+    w->line = line;
+    w->last_line = line;
+    w->started = t;
+}
+
+/*
+ * Receive whatever the worker has sent us.
+ */
+void receive_line(struct worker *w, double t)
+{
+    ssize_t status;
+    size_t msg_size = message_size();
+    int line;
+
+    status = read(w->res_fd, w->rbuf + w->rlen, msg_size - w->rlen);
+    if (status < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (status <= 0) {
+        if (status < 0)
+            perror("receive_line: read");
+        worker_died(w);
+        return;
+    }
+    w->rlen += status;
+    if (w->rlen < msg_size)
+        return;
+
+    w->rlen = 0;
+    memcpy(&line, w->rbuf, sizeof(line));
+    if (line != w->line) {
+        fprintf(stderr, "mandel: worker %ld sent line %d, expected %d\n",
+            (long) w->pid, line, w->line);
+        worker_died(w);
+        return;
+    }
+
+    lines[line].copies--;
+    if (!lines[line].done) {
+        lines[line].done = 1;
+        unpack_mandel_line(w->rbuf + sizeof(line), frame + line * x_chars);
+        line_time_sum += t - w->started;
+        line_time_count++;
+    }
+    w->line = -1;
+}
+
+/*
+ * Hand out lines to the workers and collect the results,
+ * writing finished lines to fd in order.
+ *
+ * Lines of workers that die are given to other workers,
+ * and lines that take too long are speculatively given to idle ones.
+ * Workers that get stuck are replaced.
+ * If no worker is left, the remaining lines are computed here.
+ */
+void render(int fd)
+{
+    int i, n, line, alive, idle;
+    int next_output = 0;
+    int timeout;
+    double t, deadline, wake;
+    struct pollfd *pfds;
+    struct worker **polled;
+
+    lines = calloc(y_chars, sizeof(struct line_state));
+    frame = malloc(y_chars * x_chars);
+    pfds = malloc(nworkers * sizeof(struct pollfd));
+    polled = malloc(nworkers * sizeof(struct worker *));
+    if (lines == NULL || frame == NULL || pfds == NULL || polled == NULL) {
+        perror("render: malloc");
+        exit(1);
+    }
+
+    while (next_output < y_chars) {
+        t = now();
+        restart_stalled(t);
+
+        /* Keep every idle worker busy */
+        alive = 0;
+        for (i = 0; i < nworkers; i++) {
+            if (!workers[i].alive)
+                continue;
+            if (workers[i].line < 0) {
+                line = next_line(&workers[i], next_output, t);
+                if (line >= 0)
+                    assign_line(&workers[i], line, t);
+            }
+            alive += workers[i].alive;
+        }
+
+        if (alive == 0) {
+            /* Nobody left to help us, finish the job ourselves */
+            for (line = next_output; line < y_chars; line++) {
+                if (!lines[line].done) {
+                    char payload[payload_size()];
+
+                    pack_mandel_line(line, payload);
+                    unpack_mandel_line(payload, frame + line * x_chars);
+                    lines[line].done = 1;
+                }
+            }
+        } else {
+            /*
+             * Wait for results, but wake up when a busy line
+             * becomes a straggler, to hand it to an idle worker,
+             * or when a worker is to be taken as stuck.
+             */
+            n = 0;
+            idle = 0;
+            wake = -1;
+            deadline = straggler_deadline();
+            for (i = 0; i < nworkers; i++) {
+                if (!workers[i].alive)
+                    continue;
+                if (workers[i].line < 0) {
+                    idle = 1;
+                    continue;
                 }
-                pipesem_signal(&sems[i]);
+                pfds[n].fd = workers[i].res_fd;
+                pfds[n].events = POLLIN;
+                polled[n++] = &workers[i];
+            }
+            for (i = 0; i < n; i++) {
+                line = polled[i]->line;
+                if (wake < 0 || polled[i]->started + stall_deadline(polled[i]) < wake)
+                    wake = polled[i]->started + stall_deadline(polled[i]);
+                if (idle && lines[line].copies < MANDEL_MAX_COPIES &&
+                    lines[line].issued + deadline < wake)
+                    wake = lines[line].issued + deadline;
+            }
+            timeout = -1;
+            if (wake > 0) {
+                timeout = (wake - t) * 1000 + 1;
+                if (timeout < 0)
+                    timeout = 0;
+            }
+
+            if (poll(pfds, n, timeout) < 0 && errno != EINTR) {
+                perror("render: poll");
+                exit(1);
+            }
+            t = now();
+            for (i = 0; i < n; i++) {
+                if (pfds[i].revents)
+                    receive_line(polled[i], t);
             }
-            close(pipes[i][1]);
-            return 0;
         }
-        else {
-            close(pipes[i][1]);
+
+        /* Output whatever is ready, in order */
+        while (next_output < y_chars && lines[next_output].done) {
+            output_mandel_line(fd, frame + next_output * x_chars);
+            next_output++;
         }
     }
 
+    free(pfds);
+    free(polled);
+}
+
+/*
+ * Tell idle workers to exit and kill the ones
+ * still stuck on lines that were computed by someone else.
+ */
+void stop_workers(void)
+{
+    int i, status;
+
+    for (i = 0; i < nworkers; i++) {
+        if (!workers[i].alive)
+            continue;
+        close(workers[i].cmd_fd);
+        if (workers[i].line >= 0)
+            kill(workers[i].pid, SIGKILL);
+    }
+    for (i = 0; i < nworkers; i++) {
+        if (!workers[i].alive)
+            continue;
+        waitpid(workers[i].pid, &status, 0);
+        close(workers[i].res_fd);
+        workers[i].alive = 0;
+    }
+}
+
+void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-a] [-d|-b] [-i max_iteration|auto] [-v xmin,xmax,ymin,ymax] [-s WIDTHxHEIGHT] [-w workers] [-t u8|u16|u32]\n\n"
+        "  -a  anti-alias: supersample pixels on color boundaries\n"
+        "  -d  use distance estimation to draw filaments thinner than a character\n"
+        "  -b  use distance estimation to draw only the boundary of the set\n"
+        "  -i  iteration budget per point, or auto to estimate it from the view\n"
+        "  -v  part of the complex plane to draw\n"
+        "  -s  output size in characters\n"
+        "  -w  number of worker processes\n"
+        "  -t  what workers send: colors (u8, default) or iteration counts (u16, u32)\n", argv0);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int auto_iteration = 0;
+
+    while ((opt = getopt(argc, argv, "adbi:v:s:w:t:")) != -1) {
+        switch (opt) {
+            case 'a':
+                antialias = 1;
+                break;
+            case 'd':
+                distance_mode = DE_FILAMENTS;
+                break;
+            case 'b':
+                distance_mode = DE_BOUNDARY;
+                break;
+            case 'i':
+                if (strcmp(optarg, "auto") == 0) {
+                    auto_iteration = 1;
+                    break;
+                }
+                max_iteration = atoi(optarg);
+                if (max_iteration <= 0)
+                    usage(argv[0]);
+                break;
+            case 'v':
+                if (sscanf(optarg, "%lf,%lf,%lf,%lf", &xmin, &xmax, &ymin, &ymax) != 4 ||
+                    xmin >= xmax || ymin >= ymax)
+                    usage(argv[0]);
+                break;
+            case 's':
+                if (sscanf(optarg, "%dx%d", &x_chars, &y_chars) != 2 ||
+                    x_chars <= 0 || y_chars <= 0)
+                    usage(argv[0]);
+                break;
+            case 'w':
+                nworkers = atoi(optarg);
+                if (nworkers <= 0)
+                    usage(argv[0]);
+                break;
+            case 't':
+                if (strcmp(optarg, "u8") == 0)
+                    transport = TRANSPORT_U8;
+                else if (strcmp(optarg, "u16") == 0)
+                    transport = TRANSPORT_U16;
+                else if (strcmp(optarg, "u32") == 0)
+                    transport = TRANSPORT_U32;
+                else
+                    usage(argv[0]);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+    }
+    if (antialias && transport != TRANSPORT_U8) {
+        /* Blended colors are not iteration counts */
+        fprintf(stderr, "%s: -a needs colors as the transport (-t u8)\n", argv[0]);
+        exit(1);
+    }
+
+    xstep = (xmax - xmin) / x_chars;
+    ystep = (ymax - ymin) / y_chars;
+    if (auto_iteration)
+        max_iteration = auto_max_iteration();
+
+    /*
+     * A worker that dies leaves us with a broken command pipe;
+     * we want an EPIPE from write() instead of being killed.
+     */
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+        perror("signal: sigpipe");
+        exit(1);
+    }
+
+    spawn_workers();
+
     /*
      * draw the Mandelbrot Set, one line at a time.
      * Output is sent to file descriptor '1', i.e., standard output.
      */
-    int status;
-    int bytes_read;
-    for (line = 0; line < y_chars; line++) {
-        bytes_read = 0;
-        pipesem_wait(&sems[line % NCHILDREN]);
-        while (bytes_read < x_chars * sizeof(int)) {
-            //printf( "Reading %d bytes\n", x_chars * sizeof(int) - bytes_read);
-            status = read(pipes[line % NCHILDREN][0], (void*) buffer + bytes_read, x_chars * sizeof(int) - bytes_read);
-            if (status < 0) {
-                perror("Could not read from pipe");
-                return 0;
-            }
-            bytes_read += status;
-        }
-        output_mandel_line(1, buffer);
-    }
+    render(1);
+    stop_workers();
 
     reset_xterm_color(1);
     return 0;
@@ -0,0 +1,831 @@
+/*
+ * mandeld.c
+ *
+ * A daemon that draws parts of the Mandelbrot Set on request.
+ *
+ * Clients connect to a Unix domain socket and send a single line:
+ *
+ *     xmin xmax ymin ymax width height max_iteration format
+ *
+ * where format is "xterm", for output ready for a 256-color xterm,
+ * just like the output of mandel, or "raw", for width * height bytes
+ * of xterm color values. The daemon sends the picture and closes
+ * the connection. Bad requests get a line starting with "error:",
+ * and so do connections beyond MANDELD_MAX_CLIENTS.
+ *
+ * Every line of a picture is a "tile", identified by the points it
+ * covers and the iteration budget. Tiles are computed by a pool of
+ * worker processes shared by all clients. Requests that need the same
+ * tile at the same time wait for a single computation of it, and
+ * recently finished tiles are kept in a cache for later requests.
+ *
+ * Client sockets are non-blocking: a picture is formatted a line at
+ * a time and sent as the client reads it, so a client that does not
+ * read holds up nobody but itself.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mandel-lib.h"
+
+#define MANDELD_SOCKET "/tmp/mandeld.sock"
+#define NWORKERS 4
+
+#define MANDELD_MAX_CLIENTS 64
+#define MANDELD_MAX_SIZE 4096
+#define MANDELD_MAX_ITERATION 1000000
+#define MANDELD_REQUEST_SIZE 256
+
+/*
+ * Finished tiles no request is using any more are kept around,
+ * up to MANDELD_CACHE_TILES of them; the least recently used go first.
+ */
+#define MANDELD_CACHE_TILES 4096
+#define MANDELD_HASH_SIZE 4093
+
+struct tile {
+    /* The tile covers points (xmin + xstep * n, y), 0 <= n < width */
+    double y, xmin, xstep;
+    int width;
+    int max_iteration;
+
+    enum { TILE_QUEUED, TILE_RUNNING, TILE_DONE } state;
+    unsigned char *colors;
+    int refs;                   /* requests holding this tile */
+    struct waiter *waiters;     /* requests waiting for it */
+
+    struct tile *hash_next;     /* other tiles with the same hash */
+    struct tile *queue_next;    /* tiles to be computed, in order */
+    struct tile *lru_prev;      /* unused finished tiles, */
+    struct tile *lru_next;      /* oldest first */
+};
+
+struct waiter {
+    struct client *client;
+    struct waiter *next;
+};
+
+/*
+ * What the daemon sends to a worker, to have a tile computed.
+ * The worker answers with width color values.
+ */
+struct tile_job {
+    double y, xmin, xstep;
+    int width;
+    int max_iteration;
+};
+
+struct worker {
+    pid_t pid;
+    int cmd_fd;
+    int res_fd;
+    struct tile *tile;          /* tile being computed, NULL if idle */
+    size_t rlen;                /* color values of it received so far */
+};
+
+struct client {
+    int fd;                     /* -1 if the slot is free */
+    char buf[MANDELD_REQUEST_SIZE];
+    size_t len;
+
+    /* Once the request has been read */
+    int waiting;
+    int raw;
+    int width, height;
+    struct tile **tiles;
+    int remaining;              /* tiles not done yet */
+
+    /* Once the reply is ready, it is sent a line at a time */
+    int sending;
+    int next_line;              /* next line to format */
+    char *out;                  /* output formatted but not sent yet */
+    size_t out_len, out_sent;
+};
+
+int listen_fd = -1;
+const char *socket_path = MANDELD_SOCKET;
+
+struct worker workers[NWORKERS];
+struct client clients[MANDELD_MAX_CLIENTS];
+
+struct tile *tile_hash[MANDELD_HASH_SIZE];
+struct tile *queue_head = NULL, *queue_tail = NULL;
+struct tile *lru_head = NULL, *lru_tail = NULL;
+int lru_count = 0;
+
+volatile sig_atomic_t terminate = 0;
+
+/*
+ * Read exactly count bytes, unless EOF comes first.
+ * Returns the number of bytes read, or -1 on error.
+ */
+ssize_t insist_read(int fd, void *buf, size_t count)
+{
+    ssize_t ret;
+    size_t done = 0;
+
+    while (done < count) {
+        ret = read(fd, (char *) buf + done, count - done);
+        if (ret < 0)
+            return ret;
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+
+    return done;
+}
+
+/******************
+ * Worker side    *
+ ******************/
+
+void worker(int cmd_fd, int res_fd)
+{
+    int n;
+    ssize_t status;
+    struct tile_job job;
+    unsigned char colors[MANDELD_MAX_SIZE];
+
+    for (;;) {
+        status = insist_read(cmd_fd, &job, sizeof(job));
+        if (status < 0) {
+            perror("worker: read");
+            exit(1);
+        }
+        if (status != sizeof(job))
+            exit(0);
+
+        for (n = 0; n < job.width; n++) {
+            colors[n] = xterm_color(mandel_iterations_at_point(
+                job.xmin + job.xstep * n, job.y, job.max_iteration));
+        }
+        if (insist_write(res_fd, (char *) colors, job.width) != job.width) {
+            perror("worker: write");
+            exit(1);
+        }
+    }
+}
+
+void spawn_worker(struct worker *w)
+{
+    int i;
+    int cmd[2], res[2];
+
+    if (pipe(cmd) < 0 || pipe(res) < 0) {
+        perror("spawn_worker: pipe");
+        exit(1);
+    }
+
+    w->pid = fork();
+    if (w->pid < 0) {
+        perror("spawn_worker: fork");
+        exit(1);
+    }
+    if (w->pid == 0) {
+        /* The worker only needs its own two pipes */
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        close(listen_fd);
+        for (i = 0; i < MANDELD_MAX_CLIENTS; i++) {
+            if (clients[i].fd >= 0)
+                close(clients[i].fd);
+        }
+        for (i = 0; i < NWORKERS; i++) {
+            if (&workers[i] != w && workers[i].pid > 0) {
+                close(workers[i].cmd_fd);
+                close(workers[i].res_fd);
+            }
+        }
+        close(cmd[1]);
+        close(res[0]);
+        worker(cmd[0], res[1]);
+        exit(0);
+    }
+
+    close(cmd[0]);
+    close(res[1]);
+    fcntl(res[0], F_SETFL, O_NONBLOCK);
+    w->cmd_fd = cmd[1];
+    w->res_fd = res[0];
+    w->tile = NULL;
+    w->rlen = 0;
+}
+
+/******************
+ * Tiles          *
+ ******************/
+
+unsigned tile_hash_of(double y, double xmin, double xstep, int width, int max_iteration)
+{
+    unsigned char key[3 * sizeof(double) + 2 * sizeof(int)];
+    unsigned hash = 2166136261u;
+    int i;
+
+    memcpy(key, &y, sizeof(double));
+    memcpy(key + sizeof(double), &xmin, sizeof(double));
+    memcpy(key + 2 * sizeof(double), &xstep, sizeof(double));
+    memcpy(key + 3 * sizeof(double), &width, sizeof(int));
+    memcpy(key + 3 * sizeof(double) + sizeof(int), &max_iteration, sizeof(int));
+
+    /* FNV-1a */
+    for (i = 0; i < sizeof(key); i++) {
+        hash ^= key[i];
+        hash *= 16777619u;
+    }
+
+    return hash % MANDELD_HASH_SIZE;
+}
+
+void lru_remove(struct tile *t)
+{
+    if (t->lru_prev)
+        t->lru_prev->lru_next = t->lru_next;
+    else
+        lru_head = t->lru_next;
+    if (t->lru_next)
+        t->lru_next->lru_prev = t->lru_prev;
+    else
+        lru_tail = t->lru_prev;
+    t->lru_prev = t->lru_next = NULL;
+    lru_count--;
+}
+
+void tile_free(struct tile *t)
+{
+    struct tile **p;
+
+    p = &tile_hash[tile_hash_of(t->y, t->xmin, t->xstep, t->width, t->max_iteration)];
+    while (*p != t)
+        p = &(*p)->hash_next;
+    *p = t->hash_next;
+
+    free(t->colors);
+    free(t);
+}
+
+void queue_push(struct tile *t, int front)
+{
+    t->queue_next = NULL;
+    if (queue_head == NULL) {
+        queue_head = queue_tail = t;
+    } else if (front) {
+        t->queue_next = queue_head;
+        queue_head = t;
+    } else {
+        queue_tail->queue_next = t;
+        queue_tail = t;
+    }
+}
+
+struct tile *queue_pop(void)
+{
+    struct tile *t = queue_head;
+
+    if (t != NULL) {
+        queue_head = t->queue_next;
+        if (queue_head == NULL)
+            queue_tail = NULL;
+    }
+    return t;
+}
+
+/*
+ * Get a reference to a tile: an existing one if another request
+ * needs it too, or has needed it recently, or else a new one,
+ * queued to be computed.
+ */
+struct tile *tile_get(double y, double xmin, double xstep, int width, int max_iteration)
+{
+    unsigned hash = tile_hash_of(y, xmin, xstep, width, max_iteration);
+    struct tile *t;
+
+    for (t = tile_hash[hash]; t != NULL; t = t->hash_next) {
+        if (t->y == y && t->xmin == xmin && t->xstep == xstep &&
+            t->width == width && t->max_iteration == max_iteration) {
+            if (t->refs == 0 && t->state == TILE_DONE)
+                lru_remove(t);
+            t->refs++;
+            return t;
+        }
+    }
+
+    t = calloc(1, sizeof(struct tile));
+    if (t == NULL || (t->colors = malloc(width)) == NULL) {
+        perror("tile_get: malloc");
+        exit(1);
+    }
+    t->y = y;
+    t->xmin = xmin;
+    t->xstep = xstep;
+    t->width = width;
+    t->max_iteration = max_iteration;
+    t->state = TILE_QUEUED;
+    t->refs = 1;
+    t->hash_next = tile_hash[hash];
+    tile_hash[hash] = t;
+    queue_push(t, 0);
+
+    return t;
+}
+
+/*
+ * Drop a reference to a tile. Unused finished tiles go to the cache.
+ */
+void tile_put(struct tile *t)
+{
+    if (--t->refs > 0 || t->state != TILE_DONE)
+        return;
+
+    t->lru_prev = lru_tail;
+    t->lru_next = NULL;
+    if (lru_tail)
+        lru_tail->lru_next = t;
+    else
+        lru_head = t;
+    lru_tail = t;
+    lru_count++;
+
+    while (lru_count > MANDELD_CACHE_TILES) {
+        t = lru_head;
+        lru_remove(t);
+        tile_free(t);
+    }
+}
+
+/******************
+ * Clients        *
+ ******************/
+
+void client_close(struct client *c)
+{
+    int i;
+
+    if (c->tiles) {
+        for (i = 0; i < c->height; i++)
+            tile_put(c->tiles[i]);
+        free(c->tiles);
+        c->tiles = NULL;
+    }
+    free(c->out);
+    c->out = NULL;
+    close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+    c->waiting = 0;
+    c->sending = 0;
+}
+
+/*
+ * Format the next line of the reply into the output buffer.
+ * Returns 0 when there is nothing left to send.
+ */
+int client_fill(struct client *c)
+{
+    int n;
+    char *p = c->out;
+
+    if (c->next_line < c->height) {
+        if (c->raw) {
+            memcpy(p, c->tiles[c->next_line]->colors, c->width);
+            p += c->width;
+        } else {
+            for (n = 0; n < c->width; n++)
+                p += sprintf(p, "\033[38;5;%dm@", c->tiles[c->next_line]->colors[n]);
+            *p++ = '\n';
+        }
+    } else if (c->next_line == c->height && !c->raw) {
+        memcpy(p, "\033[0m", 4);
+        p += 4;
+    } else {
+        return 0;
+    }
+
+    c->next_line++;
+    c->out_len = p - c->out;
+    c->out_sent = 0;
+    return 1;
+}
+
+/*
+ * Send as much of the reply as the socket takes without blocking,
+ * and hang up once all of it is sent, or the client is gone.
+ */
+void client_write(struct client *c)
+{
+    ssize_t status;
+
+    for (;;) {
+        if (c->out_sent == c->out_len && !client_fill(c)) {
+            client_close(c);
+            return;
+        }
+        status = write(c->fd, c->out + c->out_sent, c->out_len - c->out_sent);
+        if (status < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                client_close(c);
+            return;
+        }
+        c->out_sent += status;
+    }
+}
+
+/*
+ * Get ready to send the reply; size is the most a line of it can take.
+ */
+void client_send(struct client *c, size_t size)
+{
+    c->out = malloc(size);
+    if (c->out == NULL) {
+        perror("client_send: malloc");
+        exit(1);
+    }
+    c->out_len = c->out_sent = 0;
+    c->next_line = 0;
+    c->sending = 1;
+}
+
+void client_error(struct client *c, const char *msg)
+{
+    /* A reply of no lines, with the message already in the buffer */
+    c->raw = 1;
+    c->height = 0;
+    client_send(c, MANDELD_REQUEST_SIZE);
+    snprintf(c->out, MANDELD_REQUEST_SIZE, "error: %s\n", msg);
+    c->out_len = strlen(c->out);
+    client_write(c);
+}
+
+/*
+ * Send the finished picture to the client and hang up.
+ */
+void client_reply(struct client *c)
+{
+    /* Every point is at most "\033[38;5;255m@" */
+    client_send(c, c->width * 12 + 1);
+    client_write(c);
+}
+
+/*
+ * Parse a complete request line and get references to all its tiles.
+ */
+void client_request(struct client *c)
+{
+    int i, max_iteration;
+    double xmin, xmax, ymin, ymax, xstep, ystep;
+    char format[16];
+    struct tile *t;
+    struct waiter *w;
+
+    if (sscanf(c->buf, "%lf %lf %lf %lf %d %d %d %15s",
+               &xmin, &xmax, &ymin, &ymax, &c->width, &c->height,
+               &max_iteration, format) != 8) {
+        client_error(c, "expected: xmin xmax ymin ymax width height max_iteration format");
+        return;
+    }
+    if (!(xmin < xmax) || !(ymin < ymax)) {
+        client_error(c, "empty part of the plane");
+        return;
+    }
+    if (c->width <= 0 || c->width > MANDELD_MAX_SIZE ||
+        c->height <= 0 || c->height > MANDELD_MAX_SIZE) {
+        client_error(c, "bad picture size");
+        return;
+    }
+    if (max_iteration <= 0 || max_iteration > MANDELD_MAX_ITERATION) {
+        client_error(c, "bad max_iteration");
+        return;
+    }
+    if (strcmp(format, "raw") == 0) {
+        c->raw = 1;
+    } else if (strcmp(format, "xterm") == 0) {
+        c->raw = 0;
+    } else {
+        client_error(c, "format must be xterm or raw");
+        return;
+    }
+
+    c->tiles = malloc(c->height * sizeof(struct tile *));
+    if (c->tiles == NULL) {
+        perror("client_request: malloc");
+        exit(1);
+    }
+
+    /* Same points as mandel would draw */
+    xstep = (xmax - xmin) / c->width;
+    ystep = (ymax - ymin) / c->height;
+    c->remaining = 0;
+    for (i = 0; i < c->height; i++) {
+        t = c->tiles[i] = tile_get(ymax - ystep * i, xmin, xstep, c->width, max_iteration);
+        if (t->state == TILE_DONE)
+            continue;
+        w = malloc(sizeof(struct waiter));
+        if (w == NULL) {
+            perror("client_request: malloc");
+            exit(1);
+        }
+        w->client = c;
+        w->next = t->waiters;
+        t->waiters = w;
+        c->remaining++;
+    }
+
+    c->waiting = 1;
+    if (c->remaining == 0)
+        client_reply(c);
+}
+
+void client_read(struct client *c)
+{
+    ssize_t status;
+    char *newline;
+
+    status = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+    if (status < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (status <= 0) {
+        client_close(c);
+        return;
+    }
+    c->len += status;
+    c->buf[c->len] = '\0';
+
+    newline = strchr(c->buf, '\n');
+    if (newline == NULL) {
+        if (c->len == sizeof(c->buf) - 1)
+            client_error(c, "request too long");
+        return;
+    }
+    *newline = '\0';
+    client_request(c);
+}
+
+void client_accept(void)
+{
+    int i, fd;
+    const char busy[] = "error: too many clients\n";
+
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+        if (errno != EINTR && errno != EAGAIN)
+            perror("accept");
+        return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    for (i = 0; i < MANDELD_MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0) {
+            memset(&clients[i], 0, sizeof(struct client));
+            clients[i].fd = fd;
+            return;
+        }
+    }
+
+    /* No slot to keep it in: say so, if the socket takes it, and hang up */
+    write(fd, busy, sizeof(busy) - 1);
+    close(fd);
+}
+
+/******************
+ * Scheduling     *
+ ******************/
+
+void tile_done(struct tile *t)
+{
+    struct waiter *w, *next;
+
+    t->state = TILE_DONE;
+    for (w = t->waiters; w != NULL; w = next) {
+        next = w->next;
+        if (--w->client->remaining == 0)
+            client_reply(w->client);
+        free(w);
+    }
+    t->waiters = NULL;
+}
+
+void worker_died(struct worker *w)
+{
+    int status;
+
+    fprintf(stderr, "mandeld: worker %ld died, restarting it\n", (long) w->pid);
+    kill(w->pid, SIGKILL);
+    waitpid(w->pid, &status, 0);
+    close(w->cmd_fd);
+    close(w->res_fd);
+
+    /* Somebody is waiting for this one: compute it next */
+    if (w->tile) {
+        w->tile->state = TILE_QUEUED;
+        queue_push(w->tile, 1);
+    }
+    w->pid = 0;
+    spawn_worker(w);
+}
+
+void dispatch(void)
+{
+    int i;
+    struct tile *t;
+    struct tile_job job;
+
+    for (i = 0; i < NWORKERS; i++) {
+        if (workers[i].tile != NULL)
+            continue;
+        t = queue_pop();
+        if (t == NULL)
+            return;
+
+        job.y = t->y;
+        job.xmin = t->xmin;
+        job.xstep = t->xstep;
+        job.width = t->width;
+        job.max_iteration = t->max_iteration;
+        workers[i].tile = t;
+        workers[i].rlen = 0;
+        t->state = TILE_RUNNING;
+        if (insist_write(workers[i].cmd_fd, (char *) &job, sizeof(job)) != sizeof(job))
+            worker_died(&workers[i]);
+    }
+}
+
+void worker_read(struct worker *w)
+{
+    ssize_t status;
+    struct tile *t = w->tile;
+
+    status = read(w->res_fd, t->colors + w->rlen, t->width - w->rlen);
+    if (status < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (status <= 0) {
+        worker_died(w);
+        return;
+    }
+    w->rlen += status;
+    if (w->rlen < t->width)
+        return;
+
+    w->tile = NULL;
+    tile_done(t);
+}
+
+void serve(void)
+{
+    int i, n;
+    struct pollfd pfds[1 + MANDELD_MAX_CLIENTS + NWORKERS];
+    struct client *pclient[1 + MANDELD_MAX_CLIENTS + NWORKERS];
+    struct worker *pworker[1 + MANDELD_MAX_CLIENTS + NWORKERS];
+
+    while (!terminate) {
+        dispatch();
+
+        n = 0;
+        for (i = 0; i < MANDELD_MAX_CLIENTS; i++) {
+            if (clients[i].fd < 0)
+                continue;
+            if (clients[i].waiting && !clients[i].sending)
+                continue;
+            pfds[n].fd = clients[i].fd;
+            pfds[n].events = clients[i].sending ? POLLOUT : POLLIN;
+            pclient[n] = &clients[i];
+            pworker[n++] = NULL;
+        }
+        for (i = 0; i < NWORKERS; i++) {
+            if (workers[i].tile == NULL)
+                continue;
+            pfds[n].fd = workers[i].res_fd;
+            pfds[n].events = POLLIN;
+            pclient[n] = NULL;
+            pworker[n++] = &workers[i];
+        }
+        pfds[n].fd = listen_fd;
+        pfds[n].events = POLLIN;
+        pclient[n] = NULL;
+        pworker[n++] = NULL;
+
+        if (poll(pfds, n, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(1);
+        }
+
+        for (i = 0; i < n; i++) {
+            if (!pfds[i].revents)
+                continue;
+            if (pclient[i]) {
+                /* Closed since the poll */
+                if (pclient[i]->fd != pfds[i].fd)
+                    continue;
+                if (pclient[i]->sending)
+                    client_write(pclient[i]);
+                else
+                    client_read(pclient[i]);
+            }
+            else if (pworker[i])
+                worker_read(pworker[i]);
+            else
+                client_accept();
+        }
+    }
+}
+
+/******************
+ * Setup          *
+ ******************/
+
+void on_terminate(int signum)
+{
+    terminate = 1;
+}
+
+void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-S socket]\n\n"
+        "  -S  Unix domain socket to listen on (default: %s)\n",
+        argv0, MANDELD_SOCKET);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, opt, status;
+    struct sockaddr_un addr;
+    struct sigaction sa;
+
+    while ((opt = getopt(argc, argv, "S:")) != -1) {
+        switch (opt) {
+            case 'S':
+                socket_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc || strlen(socket_path) >= sizeof(addr.sun_path)) {
+        usage(argv[0]);
+    }
+
+    /* Clients that go away make write() fail with EPIPE */
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+        perror("signal: sigpipe");
+        exit(1);
+    }
+    sa.sa_handler = on_terminate;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGINT, &sa, NULL) < 0 || sigaction(SIGTERM, &sa, NULL) < 0) {
+        perror("sigaction");
+        exit(1);
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror(socket_path);
+        exit(1);
+    }
+    if (listen(listen_fd, MANDELD_MAX_CLIENTS) < 0) {
+        perror("listen");
+        exit(1);
+    }
+
+    for (i = 0; i < MANDELD_MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+    for (i = 0; i < NWORKERS; i++)
+        spawn_worker(&workers[i]);
+
+    serve();
+
+    for (i = 0; i < NWORKERS; i++) {
+        close(workers[i].cmd_fd);
+        kill(workers[i].pid, SIGKILL);
+        waitpid(workers[i].pid, &status, 0);
+    }
+    close(listen_fd);
+    unlink(socket_path);
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * mpmc-test.c
+ *
+ * A program to verify correct operation of the MPMC queue:
+ * producer processes enqueue numbered elements through a small
+ * queue, consumer processes dequeue them, and every element must
+ * come out exactly once, in order for each producer.
+ *
+ * Usage: mpmc-test [producers] [consumers] [elements per producer] [capacity]
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "proc-common.h"
+#include "mpmc.h"
+
+#define MPMC_TEST_PRODUCERS 3
+#define MPMC_TEST_CONSUMERS 3
+#define MPMC_TEST_ELEMENTS 300000
+#define MPMC_TEST_CAPACITY 64
+#define MPMC_TEST_MAX_PROCS 64
+
+struct element {
+	int producer;		/* -1 tells a consumer to stop */
+	long seq;
+};
+
+/* What a consumer got, in shared memory */
+struct tally {
+	long count;
+	long sum;
+};
+
+void producer(struct mpmc_queue *q, int id, long nelems)
+{
+	struct element e;
+
+	e.producer = id;
+	for (e.seq = 0; e.seq < nelems; e.seq++)
+		mpmc_enqueue(q, &e);
+	exit(0);
+}
+
+void consumer(struct mpmc_queue *q, struct tally *t, int nproducers)
+{
+	long last[MPMC_TEST_MAX_PROCS];
+	struct element e;
+	int i;
+
+	for (i = 0; i < nproducers; i++)
+		last[i] = -1;
+
+	for (;;) {
+		mpmc_dequeue(q, &e);
+		if (e.producer < 0)
+			exit(0);
+		if (e.producer >= nproducers || e.seq <= last[e.producer]) {
+			fprintf(stderr, "Consumer: got %d/%ld after %d/%ld\n",
+				e.producer, e.seq, e.producer, last[e.producer]);
+			exit(1);
+		}
+		last[e.producer] = e.seq;
+		t->count++;
+		t->sum += e.seq;
+	}
+}
+
+pid_t spawn(void)
+{
+	pid_t p = fork();
+
+	if (p < 0) {
+		perror("parent: fork");
+		exit(1);
+	}
+	return p;
+}
+
+/* Wait for n children; returns 0 if any of them failed */
+int reap(int n)
+{
+	int status, ok = 1;
+	pid_t p;
+
+	for (; n > 0; n--) {
+		p = wait(&status);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			explain_wait_status(p, status);
+			ok = 0;
+		}
+	}
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, ok;
+	int nproducers = MPMC_TEST_PRODUCERS, nconsumers = MPMC_TEST_CONSUMERS;
+	long nelems = MPMC_TEST_ELEMENTS, count = 0, sum = 0;
+	unsigned int capacity = MPMC_TEST_CAPACITY;
+	struct timespec start, end;
+	struct mpmc_queue *q;
+	struct tally *tallies;
+	struct element stop = { -1, 0 };
+
+	if (argc > 5 ||
+	    (argc > 1 && ((nproducers = atoi(argv[1])) <= 0 || nproducers > MPMC_TEST_MAX_PROCS)) ||
+	    (argc > 2 && ((nconsumers = atoi(argv[2])) <= 0 || nconsumers > MPMC_TEST_MAX_PROCS)) ||
+	    (argc > 3 && (nelems = atol(argv[3])) <= 0) ||
+	    (argc > 4 && (capacity = atoi(argv[4])) == 0)) {
+		fprintf(stderr, "Usage: %s [producers] [consumers] [elements per producer] [capacity]\n",
+			argv[0]);
+		exit(1);
+	}
+
+	q = mpmc_create(capacity, sizeof(struct element));
+	tallies = create_shared_memory_area(nconsumers * sizeof(struct tally));
+	memset(tallies, 0, nconsumers * sizeof(struct tally));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nconsumers; i++) {
+		if (spawn() == 0) {
+			consumer(q, &tallies[i], nproducers);
+			assert(0);
+		}
+	}
+	for (i = 0; i < nproducers; i++) {
+		if (spawn() == 0) {
+			producer(q, i, nelems);
+			assert(0);
+		}
+	}
+
+	/* Once the producers are done, stop every consumer */
+	ok = reap(nproducers);
+	for (i = 0; i < nconsumers; i++)
+		mpmc_enqueue(q, &stop);
+	ok = reap(nconsumers) && ok;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (i = 0; i < nconsumers; i++) {
+		count += tallies[i].count;
+		sum += tallies[i].sum;
+	}
+	if (!ok || count != nproducers * nelems ||
+	    sum != nproducers * (nelems * (nelems - 1) / 2)) {
+		printf("MPMC test failed: %ld of %ld elements, sum %ld.\n",
+		       count, nproducers * nelems, sum);
+		exit(1);
+	}
+	printf("%d producers, %d consumers, %ld elements through %u slots in %.3f s: OK\n",
+	       nproducers, nconsumers, count, capacity,
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	mpmc_destroy(q);
+	return 0;
+}
@@ -0,0 +1,211 @@
+/*
+ * mpmc.c
+ *
+ * Slot i holds element number pos, with pos % capacity == i.
+ * Its sequence number is pos when the slot is free for the producer
+ * of element pos, and pos + 1 once that element is in it; the consumer
+ * sets it to pos + capacity, freeing it for the next lap.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "futex.h"
+#include "proc-common.h"
+#include "mpmc.h"
+
+static unsigned int *slot_seq(struct mpmc_queue *q, unsigned int pos)
+{
+    return (unsigned int *) (q->slots + (size_t) (pos & (q->capacity - 1)) * q->slot_size);
+}
+
+static void *slot_data(struct mpmc_queue *q, unsigned int pos)
+{
+    return (char *) slot_seq(q, pos) + sizeof(unsigned int);
+}
+
+/*
+ * Create a queue of capacity elements of elem_size bytes,
+ * usable by all descendants of the calling process.
+ * capacity must be a power of two, and at least 2: with a single
+ * slot, "holds element pos" and "free for element pos + 1" would
+ * both be sequence number pos + 1.
+ */
+struct mpmc_queue *mpmc_create(unsigned int capacity, size_t elem_size)
+{
+    struct mpmc_queue *q;
+    size_t slot_size;
+    unsigned int i;
+
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0 || capacity > (1U << 30)) {
+        fprintf(stderr, "%s: capacity must be a power of two from 2 up, got %u\n", __func__, capacity);
+        exit(1);
+    }
+
+    /* Keep the sequence numbers aligned */
+    slot_size = (sizeof(unsigned int) + elem_size + sizeof(unsigned int) - 1)
+                / sizeof(unsigned int) * sizeof(unsigned int);
+
+    q = create_shared_memory_area_flags(sizeof(struct mpmc_queue) + capacity * slot_size,
+                                          SHM_AREA_POPULATE);
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+    q->consumers_sleeping = 0;
+    q->producers_sleeping = 0;
+    q->items_wake = 0;
+    q->space_wake = 0;
+    q->producer_spin = FUTEX_SPIN_INIT;
+    q->consumer_spin = FUTEX_SPIN_INIT;
+    q->capacity = capacity;
+    q->elem_size = elem_size;
+    q->slot_size = slot_size;
+    for (i = 0; i < capacity; i++)
+        *slot_seq(q, i) = i;
+
+    return q;
+}
+
+void mpmc_destroy(struct mpmc_queue *q)
+{
+    long page = sysconf(_SC_PAGE_SIZE);
+    size_t len = sizeof(struct mpmc_queue) + q->capacity * q->slot_size;
+
+    if (munmap(q, (len + page - 1) / page * page) < 0) {
+        perror("mpmc_destroy: munmap");
+    }
+}
+
+/*
+ * Wake up one process sleeping on *wake, if any has said it will.
+ * Sleepers check the queue again after registering in *sleeping,
+ * so either they see our update or we see them.
+ */
+static void wake_one(int *sleeping, int *wake)
+{
+    if (__atomic_load_n(sleeping, __ATOMIC_SEQ_CST) > 0) {
+        __atomic_fetch_add(wake, 1, __ATOMIC_SEQ_CST);
+        futex_wake(wake, 1);
+    }
+}
+
+/*
+ * Returns 0 if elem was enqueued, -1 if the queue is full.
+ */
+int mpmc_try_enqueue(struct mpmc_queue *q, const void *elem)
+{
+    unsigned int pos, seq;
+    int diff;
+
+    pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        seq = __atomic_load_n(slot_seq(q, pos), __ATOMIC_SEQ_CST);
+        diff = (int) (seq - pos);
+        if (diff == 0) {
+            /* The slot is free at this lap: claim the position */
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            /* Not consumed yet from the previous lap */
+            return -1;
+        } else {
+            /* Another producer got it, try the next position */
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(slot_data(q, pos), elem, q->elem_size);
+    __atomic_store_n(slot_seq(q, pos), pos + 1, __ATOMIC_SEQ_CST);
+    wake_one(&q->consumers_sleeping, &q->items_wake);
+
+    return 0;
+}
+
+/*
+ * Returns 0 if an element was dequeued into elem, -1 if the queue is empty.
+ */
+int mpmc_try_dequeue(struct mpmc_queue *q, void *elem)
+{
+    unsigned int pos, seq;
+    int diff;
+
+    pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        seq = __atomic_load_n(slot_seq(q, pos), __ATOMIC_SEQ_CST);
+        diff = (int) (seq - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            /* Nothing written there at this lap yet */
+            return -1;
+        } else {
+            pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    memcpy(elem, slot_data(q, pos), q->elem_size);
+    __atomic_store_n(slot_seq(q, pos), pos + q->capacity, __ATOMIC_SEQ_CST);
+    wake_one(&q->producers_sleeping, &q->space_wake);
+
+    return 0;
+}
+
+/*
+ * Enqueue elem, sleeping while the queue is full.
+ */
+void mpmc_enqueue(struct mpmc_queue *q, const void *elem)
+{
+    unsigned int pos;
+    int wake;
+
+    for (;;) {
+        /* Full: wait for a consumer to move dequeue_pos on */
+        pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_SEQ_CST);
+        if (mpmc_try_enqueue(q, elem) == 0)
+            return;
+        if (futex_spin((volatile int *) &q->dequeue_pos, pos, &q->producer_spin))
+            continue;
+
+        wake = __atomic_load_n(&q->space_wake, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&q->producers_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (mpmc_try_enqueue(q, elem) == 0) {
+            __atomic_fetch_sub(&q->producers_sleeping, 1, __ATOMIC_SEQ_CST);
+            return;
+        }
+        futex_wait(&q->space_wake, wake, NULL);
+        __atomic_fetch_sub(&q->producers_sleeping, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+ * Dequeue an element into elem, sleeping while the queue is empty.
+ */
+void mpmc_dequeue(struct mpmc_queue *q, void *elem)
+{
+    unsigned int pos;
+    int wake;
+
+    for (;;) {
+        /* Empty: wait for a producer to move enqueue_pos on */
+        pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_SEQ_CST);
+        if (mpmc_try_dequeue(q, elem) == 0)
+            return;
+        if (futex_spin((volatile int *) &q->enqueue_pos, pos, &q->consumer_spin))
+            continue;
+
+        wake = __atomic_load_n(&q->items_wake, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&q->consumers_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (mpmc_try_dequeue(q, elem) == 0) {
+            __atomic_fetch_sub(&q->consumers_sleeping, 1, __ATOMIC_SEQ_CST);
+            return;
+        }
+        futex_wait(&q->items_wake, wake, NULL);
+        __atomic_fetch_sub(&q->consumers_sleeping, 1, __ATOMIC_SEQ_CST);
+    }
+}
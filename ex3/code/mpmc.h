@@ -0,0 +1,55 @@
+/*
+ * mpmc.h
+ *
+ * A bounded multi-producer, multi-consumer queue of fixed-size
+ * elements, in memory shared between processes.
+ *
+ * Every slot carries a sequence number telling whether it is ready
+ * to be written or read at the current lap, as in Dmitry Vyukov's
+ * bounded MPMC queue: producers and consumers only contend on
+ * a compare-and-swap of their own position counter. Blocking
+ * operations sleep on a futex(2) only when the queue is full or empty.
+ */
+
+#ifndef MPMC_H__
+#define MPMC_H__
+
+#include <stddef.h>
+
+#define MPMC_CACHELINE 64
+
+struct mpmc_queue {
+	/*
+	 * Next position to enqueue at, sleeping consumers,
+	 * and the spin budget of producers (see futex_spin())
+	 */
+	unsigned int enqueue_pos __attribute__((aligned(MPMC_CACHELINE)));
+	int consumers_sleeping;
+	int items_wake;
+	int producer_spin;
+
+	/* Likewise, for dequeueing */
+	unsigned int dequeue_pos __attribute__((aligned(MPMC_CACHELINE)));
+	int producers_sleeping;
+	int space_wake;
+	int consumer_spin;
+
+	/* Constant after mpmc_create() */
+	unsigned int capacity __attribute__((aligned(MPMC_CACHELINE)));
+	size_t elem_size;
+	size_t slot_size;
+	char slots[] __attribute__((aligned(MPMC_CACHELINE)));
+};
+
+/*
+ * Function prototypes
+ */
+struct mpmc_queue *mpmc_create(unsigned int capacity, size_t elem_size);
+void mpmc_destroy(struct mpmc_queue *q);
+
+int mpmc_try_enqueue(struct mpmc_queue *q, const void *elem);
+int mpmc_try_dequeue(struct mpmc_queue *q, void *elem);
+void mpmc_enqueue(struct mpmc_queue *q, const void *elem);
+void mpmc_dequeue(struct mpmc_queue *q, void *elem);
+
+#endif /* MPMC_H__ */
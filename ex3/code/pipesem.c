@@ -4,14 +4,86 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include "futex.h"
+#include "syncprof.h"
 #include "pipesem.h"
 
+/*
+ * Longest sleep of pipesem_wait_any() between two looks
+ * at futex-backed semaphores, which cannot be poll()ed.
+ */
+#define PIPESEM_MAX_BACKOFF_MS 10
+
+static int pipesem_default_backend(void)
+{
+    const char *backend = getenv("PIPESEM_BACKEND");
+
+    if (backend != NULL && strcmp(backend, "pipe") == 0)
+        return PIPESEM_PIPE;
+    if (backend != NULL && strcmp(backend, "futex") == 0)
+        return PIPESEM_FUTEX;
+    if (backend != NULL && strcmp(backend, "eventfd") == 0)
+        return PIPESEM_EVENTFD;
+    return PIPESEM_DEFAULT_BACKEND;
+}
+
 void pipesem_init(struct pipesem *sem, int val)
 {
-    int i;
+    pipesem_init_backend(sem, val, pipesem_default_backend());
+}
+
+/*
+ * The semaphore must be initialized before forking
+ * the processes that are going to use it.
+ */
+void pipesem_init_backend(struct pipesem *sem, int val, int backend)
+{
+    static const char *backend_names[] = { "pipe", "futex", "eventfd" };
+    static int nsems = 0;
+    char name[ SYNCPROF_NAME ];
     int f[ 2 ];
     int status;
 
+    sem->backend = backend;
+
+    snprintf(name, sizeof(name), "pipesem %d (%s)", nsems++, backend_names[backend]);
+    sem->prof = syncprof_register(name);
+
+    if (backend == PIPESEM_FUTEX) {
+        sem->fsem = mmap(NULL, sizeof(struct futexsem), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (sem->fsem == MAP_FAILED) {
+            perror("Could not create semaphore");
+            return;
+        }
+        sem->fsem->value = val;
+        sem->fsem->waiters = 0;
+        sem->fsem->spin = FUTEX_SPIN_INIT;
+        return;
+    }
+
+    /*
+     * The read ends are non-blocking, so that a process can try to
+     * take a unit without getting stuck if someone else got there first.
+     * Waiting for real is done with poll(), see pipesem_wait_n().
+     */
+    if (backend == PIPESEM_EVENTFD) {
+        sem->rfd = sem->wfd = eventfd(val, EFD_SEMAPHORE | EFD_NONBLOCK);
+        if (sem->rfd < 0) {
+            perror("Could not create semaphore");
+        }
+        return;
+    }
+
     status = pipe(f);
     if (status < 0) {
         perror("Could not create semaphore");
@@ -21,39 +93,411 @@ void pipesem_init(struct pipesem *sem, int val)
     sem->rfd = f[ 0 ];
     sem->wfd = f[ 1 ];
 
-    for (i = 0; i < val; ++i) {
-        pipesem_signal(sem);
+    status = fcntl(sem->rfd, F_SETFL, O_NONBLOCK);
+    if (status < 0) {
+        perror("Could not create semaphore");
+        return;
+    }
+
+    if (val > 0) {
+        pipesem_signal_n(sem, val);
+    }
+}
+
+/*
+ * Futex backend: take units as they become available, entirely
+ * in userspace; when there are none, spin for a while and then
+ * sleep until the value changes.
+ */
+static void futexsem_wait(struct futexsem *f, int n)
+{
+    int val, take;
+
+    for (;;) {
+        val = __atomic_load_n(&f->value, __ATOMIC_SEQ_CST);
+        while (val > 0) {
+            take = val < n ? val : n;
+            if (__atomic_compare_exchange_n(&f->value, &val, val - take, 0,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                n -= take;
+                if (n == 0)
+                    return;
+                val -= take;
+            }
+        }
+
+        /* The signal may be just about to come */
+        if (futex_spin(&f->value, 0, &f->spin))
+            continue;
+
+        __atomic_fetch_add(&f->waiters, 1, __ATOMIC_SEQ_CST);
+        if (futex_wait(&f->value, 0, NULL) < 0 && errno != EAGAIN && errno != EINTR)
+            perror("Could not wait on semaphore");
+        __atomic_fetch_sub(&f->waiters, 1, __ATOMIC_SEQ_CST);
     }
 }
 
+static int futexsem_trywait(struct futexsem *f)
+{
+    int val;
+
+    val = __atomic_load_n(&f->value, __ATOMIC_SEQ_CST);
+    while (val > 0) {
+        if (__atomic_compare_exchange_n(&f->value, &val, val - 1, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+static void deadline_after(struct timespec *deadline, int timeout_ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+/*
+ * Time left until the deadline, or 0 if it has passed.
+ */
+static int time_left(const struct timespec *deadline, struct timespec *left)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left->tv_sec = deadline->tv_sec - now.tv_sec;
+    left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (left->tv_nsec < 0) {
+        left->tv_sec--;
+        left->tv_nsec += 1000000000L;
+    }
+    return left->tv_sec >= 0;
+}
+
+/* Same, in milliseconds rounded up, as poll() wants it */
+static int ms_left(const struct timespec *deadline)
+{
+    struct timespec left;
+
+    if (!time_left(deadline, &left))
+        return 0;
+    return left.tv_sec * 1000 + (left.tv_nsec + 999999) / 1000000;
+}
+
+static int futexsem_timedwait(struct futexsem *f, const struct timespec *deadline)
+{
+    struct timespec left;
+
+    for (;;) {
+        if (futexsem_trywait(f) == 0)
+            return 0;
+        if (!time_left(deadline, &left)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
+        __atomic_fetch_add(&f->waiters, 1, __ATOMIC_SEQ_CST);
+        if (futex_wait(&f->value, 0, &left) < 0 && errno != EAGAIN &&
+            errno != EINTR && errno != ETIMEDOUT)
+            perror("Could not wait on semaphore");
+        __atomic_fetch_sub(&f->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+ * Futex backend: only enter the kernel if somebody may be sleeping.
+ * A waiter that registers after we look at f->waiters sees the new value
+ * in futex_wait() and does not go to sleep.
+ */
+static void futexsem_signal(struct futexsem *f, int n)
+{
+    __atomic_fetch_add(&f->value, n, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&f->waiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(&f->value, n);
+}
+
 void pipesem_wait(struct pipesem *sem)
 {
-    char buffer[ 1 ];
+    pipesem_wait_n(sem, 1);
+}
+
+/*
+ * Take a unit only if one is available right now.
+ * Returns 0 on success, or -1 with errno set to EAGAIN,
+ * or to EPIPE if every write end of the pipe is closed.
+ */
+int pipesem_trywait(struct pipesem *sem)
+{
+    uint64_t unit;
+    char byte;
     int status;
 
-    status = read(sem->rfd, buffer, 1);
+    if (sem->backend == PIPESEM_FUTEX)
+        return futexsem_trywait(sem->fsem);
 
-    if (status < 0) {
+    if (sem->backend == PIPESEM_EVENTFD)
+        status = read(sem->rfd, &unit, sizeof(unit));
+    else
+        status = read(sem->rfd, &byte, 1);
+
+    if (status == 0)
+        errno = EPIPE;
+    else if (status < 0 && errno != EAGAIN)
         perror("Could not wait on semaphore");
+    return status > 0 ? 0 : -1;
+}
+
+static int timedwait(struct pipesem *sem, int timeout_ms)
+{
+    struct timespec deadline;
+    struct pollfd pfd;
+
+    deadline_after(&deadline, timeout_ms);
+    if (sem->backend == PIPESEM_FUTEX)
+        return futexsem_timedwait(sem->fsem, &deadline);
+
+    pfd.fd = sem->rfd;
+    pfd.events = POLLIN;
+    for (;;) {
+        if (pipesem_trywait(sem) == 0)
+            return 0;
+        if (errno != EAGAIN)
+            return -1;
+
+        timeout_ms = ms_left(&deadline);
+        if (timeout_ms == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+            perror("Could not wait on semaphore");
+            return -1;
+        }
+    }
+}
+
+/*
+ * Pipes and eventfds are waited on together with poll().
+ * Futex-backed semaphores cannot be poll()ed, so if there are any,
+ * they are checked again after sleeping 1, 2, 4, ... up to
+ * PIPESEM_MAX_BACKOFF_MS milliseconds.
+ */
+static int wait_any(struct pipesem sems[], int n)
+{
+    struct pollfd pfd[ n ];
+    int backoff = 0;
+    int timeout;
+    int nfds;
+    int i;
+
+    for (;;) {
+        nfds = 0;
+        for (i = 0; i < n; i++) {
+            if (pipesem_trywait(&sems[i]) == 0)
+                return i;
+            if (errno != EAGAIN)
+                return -1;
+            if (sems[i].backend != PIPESEM_FUTEX) {
+                pfd[nfds].fd = sems[i].rfd;
+                pfd[nfds].events = POLLIN;
+                nfds++;
+            }
+        }
+
+        timeout = -1;
+        if (nfds < n) {
+            timeout = backoff;
+            backoff = backoff == 0 ? 1 : 2 * backoff;
+            if (backoff > PIPESEM_MAX_BACKOFF_MS)
+                backoff = PIPESEM_MAX_BACKOFF_MS;
+        }
+        if (poll(pfd, nfds, timeout) < 0 && errno != EINTR) {
+            perror("Could not wait on semaphore");
+            return -1;
+        }
+    }
+}
+
+/*
+ * Pipes give out as many units as possible with every read();
+ * an eventfd in semaphore mode gives out a single one.
+ * When there are none, sleep in poll() until there are.
+ * A pipe whose write ends are all closed never gets any.
+ */
+static void wait_n(struct pipesem *sem, int n)
+{
+    char buffer[ 256 ];
+    uint64_t unit;
+    struct pollfd pfd;
+    int status;
+
+    if (sem->backend == PIPESEM_FUTEX) {
+        futexsem_wait(sem->fsem, n);
         return;
     }
+
+    while (n > 0) {
+        if (sem->backend == PIPESEM_EVENTFD) {
+            status = read(sem->rfd, &unit, sizeof(unit));
+            if (status > 0)
+                status = 1;
+        } else {
+            status = read(sem->rfd, buffer, n < sizeof(buffer) ? n : sizeof(buffer));
+        }
+
+        if (status == 0) {
+            errno = EPIPE;
+            status = -1;
+        } else if (status < 0 && errno == EAGAIN) {
+            pfd.fd = sem->rfd;
+            pfd.events = POLLIN;
+            status = poll(&pfd, 1, -1);
+            if (status > 0 || errno == EINTR)
+                status = 0;
+        }
+
+        if (status < 0) {
+            perror("Could not wait on semaphore");
+            return;
+        }
+        n -= status;
+    }
+}
+
+/*
+ * The blocking waits, timed for the contention profiler.
+ */
+
+/*
+ * Wait n times on the semaphore.
+ */
+void pipesem_wait_n(struct pipesem *sem, int n)
+{
+    long start = 0;
+
+    if (sem->prof >= 0)
+        start = syncprof_now();
+    wait_n(sem, n);
+    syncprof_wait(sem->prof, start);
+}
+
+/*
+ * Wait on the semaphore for at most timeout_ms milliseconds,
+ * or forever if timeout_ms is negative.
+ * Returns 0 on success, or -1 with errno set to ETIMEDOUT,
+ * or to EPIPE if every write end of the pipe is closed.
+ */
+int pipesem_timedwait(struct pipesem *sem, int timeout_ms)
+{
+    long start = 0;
+    int status;
+
+    if (timeout_ms < 0) {
+        pipesem_wait(sem);
+        return 0;
+    }
+
+    if (sem->prof >= 0)
+        start = syncprof_now();
+    status = timedwait(sem, timeout_ms);
+    syncprof_wait(sem->prof, start);
+    return status;
+}
+
+/*
+ * Wait on whichever of the n semaphores becomes available first,
+ * and return its index, or -1 on error.
+ * The wait is accounted to the semaphore that was taken.
+ */
+int pipesem_wait_any(struct pipesem sems[], int n)
+{
+    long start = 0;
+    int i;
+
+    /* Only read the clock if any of them is profiled */
+    for (i = 0; i < n; i++) {
+        if (sems[i].prof >= 0) {
+            start = syncprof_now();
+            break;
+        }
+    }
+
+    i = wait_any(sems, n);
+    if (i >= 0)
+        syncprof_wait(sems[i].prof, start);
+    return i;
 }
 
 void pipesem_signal(struct pipesem *sem)
 {
+    pipesem_signal_n(sem, 1);
+}
+
+/*
+ * Signal the semaphore n times, with a single system call
+ * (or none, for the futex backend when nobody is waiting).
+ */
+void pipesem_signal_n(struct pipesem *sem, int n)
+{
+    char buffer[ 256 ];
+    uint64_t units;
     int status;
-    status = write(sem->wfd, "_", 1);
+    int chunk;
 
-    if (status < 0) {
-        perror("Could not signal semaphore");
+    syncprof_signal(sem->prof, n);
+
+    if (sem->backend == PIPESEM_FUTEX) {
+        futexsem_signal(sem->fsem, n);
+        return;
+    }
+
+    if (sem->backend == PIPESEM_EVENTFD) {
+        units = n;
+        status = write(sem->wfd, &units, sizeof(units));
+        if (status < 0) {
+            perror("Could not signal semaphore");
+        }
         return;
     }
+
+    memset(buffer, '_', sizeof(buffer));
+    while (n > 0) {
+        chunk = n < sizeof(buffer) ? n : sizeof(buffer);
+        status = write(sem->wfd, buffer, chunk);
+
+        if (status < 0) {
+            perror("Could not signal semaphore");
+            return;
+        }
+        n -= status;
+    }
 }
 
 void pipesem_destroy(struct pipesem *sem)
 {
     int status;
 
+    if (sem->backend == PIPESEM_FUTEX) {
+        status = munmap(sem->fsem, sizeof(struct futexsem));
+        if (status < 0) {
+            perror("Could not destroy semaphore");
+        }
+        return;
+    }
+
+    if (sem->backend == PIPESEM_EVENTFD) {
+        status = close(sem->rfd);
+        if (status < 0) {
+            perror("Could not destroy semaphore");
+        }
+        return;
+    }
+
     status = close(sem->rfd);
     if (status < 0) {
         perror("Could not destroy semaphore (read end indestructible)");
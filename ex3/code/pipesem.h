@@ -1,4 +1,3 @@
-
 /*
  * pipesem.h
  *
@@ -11,21 +10,69 @@
 #ifndef PIPESEM_H__
 #define PIPESEM_H__
 
+/*
+ * Available implementations of a semaphore:
+ * a pipe holding one byte per unit of value, an eventfd(2)
+ * counter in semaphore mode, or a counter in shared memory
+ * that only needs a futex(2) system call when a process
+ * has to sleep or be woken up.
+ *
+ * A pipe can only hold as many units as fit in its buffer
+ * (64KiB on Linux); signaling beyond that blocks.
+ */
+enum pipesem_backend {
+	PIPESEM_PIPE,
+	PIPESEM_FUTEX,
+	PIPESEM_EVENTFD
+};
+
+/*
+ * Backend used by pipesem_init(), unless overridden at run time
+ * with PIPESEM_BACKEND=pipe, futex or eventfd in the environment.
+ */
+#ifndef PIPESEM_DEFAULT_BACKEND
+#define PIPESEM_DEFAULT_BACKEND PIPESEM_PIPE
+#endif
+
+/*
+ * The state of a futex-backed semaphore, in a shared mapping.
+ */
+struct futexsem {
+	int value;
+	int waiters;
+	int spin;		/* see futex_spin() */
+};
+
 struct pipesem {
+	int backend;
+
 	/*
 	 * Two file descriptors:
-	 * one for the read and one for the write end of a pipe
+	 * one for the read and one for the write end of a pipe.
+	 * Both are the same eventfd for the eventfd backend.
 	 */
 	int rfd;
 	int wfd;
+
+	/* Futex backend */
+	struct futexsem *fsem;
+
+	/* Slot in the contention profiler, or -1 */
+	int prof;
 };
 
 /*
  * Function prototypes
  */
 void pipesem_init(struct pipesem *sem, int val);
+void pipesem_init_backend(struct pipesem *sem, int val, int backend);
 void pipesem_wait(struct pipesem *sem);
 void pipesem_signal(struct pipesem *sem);
+int pipesem_trywait(struct pipesem *sem);
+int pipesem_timedwait(struct pipesem *sem, int timeout_ms);
+int pipesem_wait_any(struct pipesem sems[], int n);
+void pipesem_wait_n(struct pipesem *sem, int n);
+void pipesem_signal_n(struct pipesem *sem, int n);
 void pipesem_destroy(struct pipesem *sem);
 
 #endif /* PIPESEM_H__ */
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
@@ -111,29 +112,107 @@ show_pstree(pid_t p)
 }
 
 
+/*
+ * Size of a huge page, from /proc/meminfo, or 2MiB if unknown.
+ */
+static long huge_page_size(void)
+{
+	FILE *f;
+	char line[128];
+	long kb = 0;
+
+	f = fopen("/proc/meminfo", "r");
+	if (f != NULL) {
+		while (fgets(line, sizeof(line), f) != NULL)
+			if (sscanf(line, "Hugepagesize: %ld kB", &kb) == 1)
+				break;
+		fclose(f);
+	}
+
+	return kb > 0 ? kb * 1024 : 2 * 1024 * 1024;
+}
+
 /*
  * Create a shared memory area, usable by all descendants of the calling process.
  */
-void *create_shared_memory_area(unsigned int numbytes)
+void *create_shared_memory_area(size_t numbytes)
 {
-	int pages;
+	return create_shared_memory_area_flags(numbytes, 0);
+}
+
+/*
+ * Same, with a combination of SHM_AREA_* flags:
+ *
+ * SHM_AREA_HUGETLB: back the area with huge pages from the pool
+ *                   reserved by the administrator (vm.nr_hugepages),
+ *                   if there are enough of them; otherwise fall back
+ *                   to normal pages, with SHM_AREA_THP.
+ * SHM_AREA_THP:     ask for transparent huge pages; whether the kernel
+ *                   gives us any depends on
+ *                   /sys/kernel/mm/transparent_hugepage/shmem_enabled.
+ * SHM_AREA_POPULATE: fault all pages in now, rather than on first touch.
+ */
+void *create_shared_memory_area_flags(size_t numbytes, int flags)
+{
+	long page;
+	size_t size;
 	void *addr;
+	int mmap_flags = MAP_SHARED | MAP_ANONYMOUS;
 
 	if (numbytes == 0) {
 		fprintf(stderr, "%s: internal error: called for numbytes == 0\n", __func__);
 		exit(1);
 	}
 
+	if (flags & SHM_AREA_POPULATE)
+		mmap_flags |= MAP_POPULATE;
+
+	if (flags & SHM_AREA_HUGETLB) {
+		page = huge_page_size();
+		size = (numbytes + page - 1) / page * page;
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			mmap_flags | MAP_HUGETLB, -1, 0);
+		if (addr != MAP_FAILED)
+			return addr;
+		flags |= SHM_AREA_THP;
+	}
+
 	/* Determine the number of pages needed, round up the requested number of pages */
-	pages = (numbytes - 1) / sysconf(_SC_PAGE_SIZE) + 1;
+	page = sysconf(_SC_PAGE_SIZE);
+	size = (numbytes - 1) / page * page + page;
 
 	/* Create a shared, anonymous mapping for this number of pages */
-	addr = mmap(NULL, pages * sysconf(_SC_PAGE_SIZE),
-		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, mmap_flags, -1, 0);
 	if (addr == MAP_FAILED) {
 		perror("create_shared_memory_area: mmap failed");
 		exit(1);
 	}
 
+	/* Only a hint: the area is fine without huge pages */
+	if (flags & SHM_AREA_THP)
+		madvise(addr, size, MADV_HUGEPAGE);
+
 	return addr;
 }
+
+/*
+ * Unmap an area of numbytes bytes made by create_shared_memory_area*().
+ * munmap() refuses to cut a huge page mapping short, so if the area
+ * turns out to be one, unmap it in whole huge pages.
+ */
+void destroy_shared_memory_area(void *addr, size_t numbytes)
+{
+	long page = sysconf(_SC_PAGE_SIZE);
+	size_t size = (numbytes - 1) / page * page + page;
+
+	if (munmap(addr, size) == 0)
+		return;
+	if (errno == EINVAL) {
+		page = huge_page_size();
+		size = (numbytes + page - 1) / page * page;
+		if (munmap(addr, size) == 0)
+			return;
+	}
+	perror("destroy_shared_memory_area: munmap failed");
+	exit(1);
+}
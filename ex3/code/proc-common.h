@@ -31,6 +31,21 @@ void show_pstree(pid_t p);
 /*
  * Create a shared memory area, usable by all descendants of the calling process.
  */
-void *create_shared_memory_area(unsigned int numbytes);
+void *create_shared_memory_area(size_t numbytes);
+
+/*
+ * Options for create_shared_memory_area_flags(),
+ * for large areas used in timed code.
+ */
+#define SHM_AREA_HUGETLB	0x1	/* huge pages, if any are reserved */
+#define SHM_AREA_THP		0x2	/* transparent huge pages, if enabled */
+#define SHM_AREA_POPULATE	0x4	/* no page faults on first touch */
+
+void *create_shared_memory_area_flags(size_t numbytes, int flags);
+
+/*
+ * Unmap an area made by one of the above, given the size asked for.
+ */
+void destroy_shared_memory_area(void *addr, size_t numbytes);
 
 #endif /* PROC_COMMON_H */
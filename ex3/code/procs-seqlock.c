@@ -0,0 +1,164 @@
+/*
+ * procs-seqlock.c
+ *
+ * The three processes of procs-shm.c, without semaphores:
+ * proc_A and proc_B update the shared value under a seqlock,
+ * and proc_C takes consistent snapshots of it, never stopping
+ * the writers. Atomic counters keep track of the steps taken.
+ *
+ * Along with n, the writers count their updates, so that
+ * proc_C can check that n == 1 + a - 2b in every snapshot.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "proc-common.h"
+#include "shm-atomic.h"
+
+/* How often proc_C prints a snapshot */
+#define PRINT_EVERY (1 << 20)
+
+/*
+ * The shared value, and the number of times
+ * proc_A and proc_B have updated it.
+ */
+struct shared_value {
+	int n;
+	long a;
+	long b;
+};
+
+/*
+ * The shared memory area: the value and its seqlock,
+ * the number of updates made so far,
+ * and the number of writers that are done.
+ */
+struct shared {
+	struct seqlock lock;
+	struct shared_value v;
+	struct shm_counter updates;
+	struct shm_counter writers_done;
+};
+
+struct shared *shared_memory;
+long steps = 1000000;
+
+/* Proc A: n = n + 1 */
+void proc_A(void)
+{
+	struct shared *s = shared_memory;
+	long i;
+
+	for (i = 0; i < steps; i++) {
+		seqlock_write_lock(&s->lock);
+		s->v.n = s->v.n + 1;
+		s->v.a++;
+		seqlock_write_unlock(&s->lock);
+		shm_counter_add(&s->updates, 1);
+	}
+
+	shm_counter_add(&s->writers_done, 1);
+	exit(0);
+}
+
+/* Proc B: n = n - 2 */
+void proc_B(void)
+{
+	struct shared *s = shared_memory;
+	long i;
+
+	for (i = 0; i < steps; i++) {
+		seqlock_write_lock(&s->lock);
+		s->v.n = s->v.n - 2;
+		s->v.b++;
+		seqlock_write_unlock(&s->lock);
+		shm_counter_add(&s->updates, 1);
+	}
+
+	shm_counter_add(&s->writers_done, 1);
+	exit(0);
+}
+
+/* Proc C: check n against the number of updates */
+void proc_C(void)
+{
+	struct shared *s = shared_memory;
+	struct shared_value v;
+	long reads = 0;
+	int done;
+
+	do {
+		done = shm_counter_read(&s->writers_done) == 2;
+		seqlock_read(&s->lock, &v, &s->v, sizeof(v));
+		if (v.n != 1 + v.a - 2 * v.b) {
+			printf("Proc C: n = %d, a = %ld, b = %ld ...Aaaaaargh!\n",
+				v.n, v.a, v.b);
+			exit(1);
+		}
+		if (++reads % PRINT_EVERY == 0 || done)
+			printf("Proc C: n = %d, a = %ld, b = %ld, %ld updates\n",
+				v.n, v.a, v.b, shm_counter_read(&s->updates));
+	} while (!done);
+
+	printf("Proc C: %ld consistent snapshots\n", reads);
+	exit(0);
+}
+
+/*
+ * Use a NULL-terminated array of pointers to functions.
+ * Each child process gets to call a different pointer.
+ */
+typedef void proc_fn_t(void);
+static proc_fn_t *proc_funcs[] = {proc_A, proc_B, proc_C, NULL};
+
+int main(int argc, char *argv[])
+{
+	int i;
+	int status;
+	pid_t p;
+	proc_fn_t *proc_fn;
+
+	if (argc > 2 || (argc == 2 && (steps = atol(argv[1])) <= 0)) {
+		fprintf(stderr, "Usage: %s [steps]\n", argv[0]);
+		exit(1);
+	}
+
+	/* Create a shared memory area */
+	shared_memory = create_shared_memory_area(sizeof(struct shared));
+	seqlock_init(&shared_memory->lock);
+	shared_memory->v.n = 1;
+	shared_memory->v.a = 0;
+	shared_memory->v.b = 0;
+	shm_counter_init(&shared_memory->updates, 0);
+	shm_counter_init(&shared_memory->writers_done, 0);
+
+	for (i = 0; (proc_fn = proc_funcs[i]) != NULL; i++) {
+		p = fork();
+		if (p < 0) {
+			perror("parent: fork");
+			exit(1);
+		}
+		if (p != 0) {
+			/* Father */
+			continue;
+		}
+		/* Child */
+		proc_fn();
+		assert(0);
+	}
+
+	/* Parent waits for all children to terminate */
+	for (; i > 0; i--) {
+		p = wait(&status);
+		explain_wait_status(p, status);
+	}
+
+	return 0;
+}
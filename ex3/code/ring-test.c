@@ -0,0 +1,141 @@
+/*
+ * ring-test.c
+ *
+ * A program to verify correct operation of the ring buffer:
+ * a producer process sends messages of varying length through
+ * a small ring, and the consumer checks that every one of them
+ * arrives whole and in order, then sees the end of the stream.
+ *
+ * Usage: ring-test [messages] [ring size]
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "proc-common.h"
+#include "ring.h"
+
+#define RING_TEST_MESSAGES 1000000
+#define RING_TEST_SIZE 4096
+#define RING_TEST_MAX_PAYLOAD 251
+
+/*
+ * Every message is its sequence number, a payload length,
+ * and that many bytes derived from the sequence number.
+ */
+struct message {
+	unsigned long seq;
+	unsigned int len;
+	unsigned char payload[RING_TEST_MAX_PAYLOAD];
+};
+
+void make_message(struct message *m, unsigned long seq)
+{
+	unsigned int i;
+
+	m->seq = seq;
+	m->len = seq % RING_TEST_MAX_PAYLOAD;
+	for (i = 0; i < m->len; i++)
+		m->payload[i] = seq + i;
+}
+
+size_t header_size(void)
+{
+	return offsetof(struct message, payload);
+}
+
+void producer(struct ring *r, unsigned long nmsgs)
+{
+	unsigned long seq;
+	struct message m;
+
+	for (seq = 0; seq < nmsgs; seq++) {
+		make_message(&m, seq);
+		ring_write(r, &m, header_size() + m.len);
+	}
+	ring_close(r);
+	exit(0);
+}
+
+void consumer(struct ring *r, unsigned long nmsgs)
+{
+	unsigned long seq;
+	struct message m, want;
+	char extra;
+
+	for (seq = 0; seq < nmsgs; seq++) {
+		make_message(&want, seq);
+		if (ring_read(r, &m, header_size()) != header_size() ||
+		    m.seq != seq || m.len != want.len ||
+		    ring_read(r, m.payload, m.len) != m.len ||
+		    memcmp(m.payload, want.payload, m.len) != 0) {
+			fprintf(stderr, "Consumer: message %lu is wrong\n", seq);
+			exit(1);
+		}
+	}
+	if (ring_read(r, &extra, 1) != 0) {
+		fprintf(stderr, "Consumer: data after the last message\n");
+		exit(1);
+	}
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, status, ok = 1;
+	unsigned long nmsgs = RING_TEST_MESSAGES;
+	unsigned int size = RING_TEST_SIZE;
+	struct timespec start, end;
+	struct ring *r;
+	pid_t p;
+
+	if (argc > 3 || (argc > 1 && (nmsgs = atol(argv[1])) == 0) ||
+	    (argc > 2 && (size = atoi(argv[2])) == 0)) {
+		fprintf(stderr, "Usage: %s [messages] [ring size]\n", argv[0]);
+		exit(1);
+	}
+
+	r = ring_create(size);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < 2; i++) {
+		p = fork();
+		if (p < 0) {
+			perror("parent: fork");
+			exit(1);
+		}
+		if (p == 0) {
+			if (i == 0)
+				producer(r, nmsgs);
+			else
+				consumer(r, nmsgs);
+			assert(0);
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		p = wait(&status);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			explain_wait_status(p, status);
+			ok = 0;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (!ok) {
+		printf("Ring test failed.\n");
+		exit(1);
+	}
+	printf("%lu messages through a %u byte ring in %.3f s: OK\n", nmsgs, size,
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	ring_destroy(r);
+	return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * ring.c
+ *
+ * head and tail count all the bytes ever written and read,
+ * and wrap around naturally: the ring holds head - tail bytes,
+ * starting at data[tail % size].
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "futex.h"
+#include "proc-common.h"
+#include "ring.h"
+
+/*
+ * Create a ring of size bytes, usable by all descendants
+ * of the calling process. size must be a power of two.
+ */
+struct ring *ring_create(unsigned int size)
+{
+    struct ring *r;
+
+    if (size == 0 || (size & (size - 1)) != 0 || size > (1U << 30)) {
+        fprintf(stderr, "%s: size must be a power of two, got %u\n", __func__, size);
+        exit(1);
+    }
+
+    r = create_shared_memory_area_flags(sizeof(struct ring) + size, SHM_AREA_POPULATE);
+    r->head = 0;
+    r->tail = 0;
+    r->closed = 0;
+    r->producer_sleeping = 0;
+    r->producer_wake = 0;
+    r->producer_spin = FUTEX_SPIN_INIT;
+    r->consumer_sleeping = 0;
+    r->consumer_wake = 0;
+    r->consumer_spin = FUTEX_SPIN_INIT;
+    r->size = size;
+
+    return r;
+}
+
+void ring_destroy(struct ring *r)
+{
+    long page = sysconf(_SC_PAGE_SIZE);
+    size_t len = (sizeof(struct ring) + r->size + page - 1) / page * page;
+
+    if (munmap(r, len) < 0) {
+        perror("ring_destroy: munmap");
+    }
+}
+
+/*
+ * Wake the other side up, if it has said it is going to sleep.
+ * Sleepers check the ring again after setting *sleeping and only
+ * sleep if *wake has not changed since before that, so either they
+ * see our update or we see them sleeping.
+ */
+static void wake_up(int *sleeping, int *wake)
+{
+    if (__atomic_load_n(sleeping, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(wake, 1, __ATOMIC_SEQ_CST);
+        futex_wake(wake, 1);
+    }
+}
+
+/*
+ * Copy count bytes starting at ring position pos,
+ * in two pieces if they wrap around the end of data[].
+ */
+static void copy_in(struct ring *r, unsigned int pos, const char *buf, size_t count)
+{
+    size_t off = pos & (r->size - 1);
+    size_t first = count < r->size - off ? count : r->size - off;
+
+    memcpy(r->data + off, buf, first);
+    memcpy(r->data, buf + first, count - first);
+}
+
+static void copy_out(struct ring *r, unsigned int pos, char *buf, size_t count)
+{
+    size_t off = pos & (r->size - 1);
+    size_t first = count < r->size - off ? count : r->size - off;
+
+    memcpy(buf, r->data + off, first);
+    memcpy(buf + first, r->data, count - first);
+}
+
+/*
+ * Write as many bytes as there is room for, without blocking.
+ * Returns the number of bytes written.
+ */
+size_t ring_try_write(struct ring *r, const void *buf, size_t count)
+{
+    unsigned int head = r->head;
+    unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    size_t room = r->size - (head - tail);
+
+    if (count > room)
+        count = room;
+    if (count == 0)
+        return 0;
+
+    copy_in(r, head, buf, count);
+    __atomic_store_n(&r->head, head + count, __ATOMIC_SEQ_CST);
+    wake_up(&r->consumer_sleeping, &r->consumer_wake);
+
+    return count;
+}
+
+/*
+ * Read as many bytes as are available, up to count, without blocking.
+ * Returns the number of bytes read.
+ */
+size_t ring_try_read(struct ring *r, void *buf, size_t count)
+{
+    unsigned int tail = r->tail;
+    unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    size_t avail = head - tail;
+
+    if (count > avail)
+        count = avail;
+    if (count == 0)
+        return 0;
+
+    copy_out(r, tail, buf, count);
+    __atomic_store_n(&r->tail, tail + count, __ATOMIC_SEQ_CST);
+    wake_up(&r->producer_sleeping, &r->producer_wake);
+
+    return count;
+}
+
+/*
+ * Write all count bytes, sleeping while the ring is full.
+ */
+void ring_write(struct ring *r, const void *buf, size_t count)
+{
+    const char *p = buf;
+    size_t done;
+    int wake;
+
+    while (count > 0) {
+        done = ring_try_write(r, p, count);
+        p += done;
+        count -= done;
+        if (done > 0)
+            continue;
+
+        /* Full: wait until the consumer reads something */
+        if (futex_spin((volatile int *) &r->tail, r->head - r->size, &r->producer_spin))
+            continue;
+        wake = __atomic_load_n(&r->producer_wake, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&r->producer_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (r->head - __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == r->size)
+            futex_wait(&r->producer_wake, wake, NULL);
+        __atomic_store_n(&r->producer_sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+ * Read count bytes, sleeping while the ring is empty.
+ * Returns fewer than count bytes only if the producer has
+ * closed the ring and there is nothing more to read.
+ */
+size_t ring_read(struct ring *r, void *buf, size_t count)
+{
+    char *p = buf;
+    size_t done, total = 0;
+    int wake;
+
+    while (total < count) {
+        done = ring_try_read(r, p + total, count - total);
+        total += done;
+        if (done > 0)
+            continue;
+
+        /*
+         * Empty: we are done if the producer has closed the ring
+         * (closed is set after the last write), otherwise wait
+         * until it writes something or closes.
+         */
+        if (__atomic_load_n(&r->closed, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&r->head, __ATOMIC_SEQ_CST) == r->tail)
+            break;
+        if (futex_spin((volatile int *) &r->head, r->tail, &r->consumer_spin))
+            continue;
+        wake = __atomic_load_n(&r->consumer_wake, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&r->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) == r->tail &&
+            !__atomic_load_n(&r->closed, __ATOMIC_SEQ_CST))
+            futex_wait(&r->consumer_wake, wake, NULL);
+        __atomic_store_n(&r->consumer_sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    return total;
+}
+
+/*
+ * The producer is done: once the ring is drained,
+ * ring_read() returns short counts.
+ */
+void ring_close(struct ring *r)
+{
+    __atomic_store_n(&r->closed, 1, __ATOMIC_SEQ_CST);
+    wake_up(&r->consumer_sleeping, &r->consumer_wake);
+}
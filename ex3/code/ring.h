@@ -0,0 +1,55 @@
+/*
+ * ring.h
+ *
+ * A single-producer, single-consumer ring buffer of bytes,
+ * in memory shared between processes.
+ *
+ * The producer and the consumer only touch their own index,
+ * on a cache line of its own, and exchange data without
+ * system calls; a futex(2) call is only made to sleep when
+ * the ring is empty (consumer) or full (producer), and to wake
+ * a sleeping partner up.
+ */
+
+#ifndef RING_H__
+#define RING_H__
+
+#include <stddef.h>
+
+#define RING_CACHELINE 64
+
+struct ring {
+	/*
+	 * Written by the producer; producer_wake is bumped
+	 * by the consumer to wake a sleeping producer up.
+	 */
+	unsigned int head __attribute__((aligned(RING_CACHELINE)));
+	int closed;
+	int producer_sleeping;
+	int producer_wake;
+	int producer_spin;	/* see futex_spin() */
+
+	/* Likewise, for the consumer */
+	unsigned int tail __attribute__((aligned(RING_CACHELINE)));
+	int consumer_sleeping;
+	int consumer_wake;
+	int consumer_spin;
+
+	/* Constant after ring_create() */
+	unsigned int size __attribute__((aligned(RING_CACHELINE)));
+	char data[] __attribute__((aligned(RING_CACHELINE)));
+};
+
+/*
+ * Function prototypes
+ */
+struct ring *ring_create(unsigned int size);
+void ring_destroy(struct ring *r);
+
+size_t ring_try_write(struct ring *r, const void *buf, size_t count);
+size_t ring_try_read(struct ring *r, void *buf, size_t count);
+void ring_write(struct ring *r, const void *buf, size_t count);
+size_t ring_read(struct ring *r, void *buf, size_t count);
+void ring_close(struct ring *r);
+
+#endif /* RING_H__ */
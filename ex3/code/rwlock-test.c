@@ -0,0 +1,145 @@
+/*
+ * rwlock-test.c
+ *
+ * A program to verify correct operation of the reader-writer lock:
+ * writer processes update a pair of counters that must always be
+ * equal, and reader processes check them. A writer must always
+ * be alone in the lock, and readers must never see a half-done
+ * update. Every third lock is first tried with a try variant.
+ *
+ * Usage: rwlock-test [readers] [writers] [iterations]
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "proc-common.h"
+#include "rwlock.h"
+
+#define RWLOCK_TEST_READERS 4
+#define RWLOCK_TEST_WRITERS 2
+#define RWLOCK_TEST_ITERATIONS 200000
+
+struct shared {
+	struct rwlock lock;
+	long a, b;		/* a == b, outside of a writer */
+	int readers_in;
+	int writers_in;
+	int max_readers_in;	/* most readers seen in at once */
+};
+
+void fail(const char *msg)
+{
+	fprintf(stderr, "%ld: %s\n", (long) getpid(), msg);
+	exit(1);
+}
+
+void writer(struct shared *s, long iterations)
+{
+	long i;
+
+	for (i = 0; i < iterations; i++) {
+		if (i % 3 != 0 || rwlock_trywrlock(&s->lock) < 0)
+			rwlock_wrlock(&s->lock);
+		if (__atomic_fetch_add(&s->writers_in, 1, __ATOMIC_SEQ_CST) != 0 ||
+		    __atomic_load_n(&s->readers_in, __ATOMIC_SEQ_CST) != 0)
+			fail("Writer: not alone in the lock");
+		s->a++;
+		if (i % 64 == 0)
+			sched_yield();
+		s->b++;
+		__atomic_fetch_sub(&s->writers_in, 1, __ATOMIC_SEQ_CST);
+		rwlock_wrunlock(&s->lock);
+	}
+	exit(0);
+}
+
+void reader(struct shared *s, long iterations)
+{
+	long i;
+	int in, max;
+
+	for (i = 0; i < iterations; i++) {
+		if (i % 3 != 0 || rwlock_tryrdlock(&s->lock) < 0)
+			rwlock_rdlock(&s->lock);
+		in = __atomic_add_fetch(&s->readers_in, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&s->writers_in, __ATOMIC_SEQ_CST) != 0)
+			fail("Reader: a writer is in the lock");
+		if (*(volatile long *) &s->a != *(volatile long *) &s->b)
+			fail("Reader: saw a half-done update");
+		max = __atomic_load_n(&s->max_readers_in, __ATOMIC_RELAXED);
+		while (in > max && !__atomic_compare_exchange_n(&s->max_readers_in, &max, in, 1,
+		                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+		if (i % 64 == 0)
+			sched_yield();
+		__atomic_fetch_sub(&s->readers_in, 1, __ATOMIC_SEQ_CST);
+		rwlock_rdunlock(&s->lock);
+	}
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, status, ok = 1;
+	int nreaders = RWLOCK_TEST_READERS, nwriters = RWLOCK_TEST_WRITERS;
+	long iterations = RWLOCK_TEST_ITERATIONS;
+	struct timespec start, end;
+	struct shared *s;
+	pid_t p;
+
+	if (argc > 4 || (argc > 1 && (nreaders = atoi(argv[1])) < 0) ||
+	    (argc > 2 && (nwriters = atoi(argv[2])) < 0) ||
+	    (argc > 3 && (iterations = atol(argv[3])) <= 0)) {
+		fprintf(stderr, "Usage: %s [readers] [writers] [iterations]\n", argv[0]);
+		exit(1);
+	}
+
+	s = create_shared_memory_area(sizeof(*s));
+	memset(s, 0, sizeof(*s));
+	rwlock_init(&s->lock);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < nreaders + nwriters; i++) {
+		p = fork();
+		if (p < 0) {
+			perror("parent: fork");
+			exit(1);
+		}
+		if (p == 0) {
+			if (i < nwriters)
+				writer(s, iterations);
+			else
+				reader(s, iterations);
+			assert(0);
+		}
+	}
+
+	for (i = 0; i < nreaders + nwriters; i++) {
+		p = wait(&status);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			explain_wait_status(p, status);
+			ok = 0;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (!ok || s->a != nwriters * iterations || s->b != s->a) {
+		printf("Rwlock test failed: %ld and %ld writes of %ld.\n",
+		       s->a, s->b, nwriters * iterations);
+		exit(1);
+	}
+	printf("%d readers (up to %d at once), %d writers, %ld iterations each in %.3f s: OK\n",
+	       nreaders, s->max_readers_in, nwriters, iterations,
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	return 0;
+}
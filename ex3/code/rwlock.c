@@ -0,0 +1,160 @@
+/*
+ * rwlock.c
+ *
+ * Sleepers register in *_sleeping and then check the lock again
+ * before calling futex_wait() on the wake counter they read
+ * beforehand. Whoever releases the lock publishes the new state
+ * first, and then looks for sleepers; with sequentially consistent
+ * atomics, either the sleeper sees the lock free or we see it
+ * registered and bump the wake counter, so no wakeup gets lost.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <limits.h>
+
+#include "futex.h"
+#include "syncprof.h"
+#include "rwlock.h"
+
+/*
+ * Initialize a lock in memory shared by all the processes
+ * that are going to use it.
+ */
+void rwlock_init(struct rwlock *l)
+{
+    static int nlocks = 0;
+    char name[ SYNCPROF_NAME ];
+
+    snprintf(name, sizeof(name), "rwlock %d read", nlocks);
+    l->prof_read = syncprof_register(name);
+    snprintf(name, sizeof(name), "rwlock %d write", nlocks++);
+    l->prof_write = syncprof_register(name);
+
+    l->state = 0;
+    l->writers_waiting = 0;
+    l->readers_sleeping = 0;
+    l->readers_wake = 0;
+    l->writers_sleeping = 0;
+    l->writers_wake = 0;
+    l->spin = FUTEX_SPIN_INIT;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void wake_up(int *sleeping, int *wake, int nr)
+{
+    if (__atomic_load_n(sleeping, __ATOMIC_SEQ_CST) > 0) {
+        __atomic_fetch_add(wake, 1, __ATOMIC_SEQ_CST);
+        futex_wake(wake, nr);
+    }
+}
+
+/* Readers keep out while a writer holds the lock or waits for it */
+static int readers_may_enter(struct rwlock *l)
+{
+    return !(__atomic_load_n(&l->state, __ATOMIC_SEQ_CST) & RWLOCK_WRITER) &&
+           __atomic_load_n(&l->writers_waiting, __ATOMIC_SEQ_CST) == 0;
+}
+
+/*
+ * Returns 0 if the lock was taken for reading,
+ * -1 if a writer holds it or is waiting for it.
+ */
+int rwlock_tryrdlock(struct rwlock *l)
+{
+    int state;
+
+    while (readers_may_enter(l)) {
+        state = __atomic_load_n(&l->state, __ATOMIC_SEQ_CST);
+        if (!(state & RWLOCK_WRITER) &&
+            __atomic_compare_exchange_n(&l->state, &state, state + 1, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return 0;
+    }
+    return -1;
+}
+
+void rwlock_rdlock(struct rwlock *l)
+{
+    int state, wake;
+    long start = 0;
+
+    if (l->prof_read >= 0)
+        start = syncprof_now();
+
+    while (rwlock_tryrdlock(l) < 0) {
+        state = __atomic_load_n(&l->state, __ATOMIC_SEQ_CST);
+        if (futex_spin(&l->state, state, &l->spin))
+            continue;
+
+        wake = __atomic_load_n(&l->readers_wake, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&l->readers_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!readers_may_enter(l))
+            futex_wait(&l->readers_wake, wake, NULL);
+        __atomic_fetch_sub(&l->readers_sleeping, 1, __ATOMIC_SEQ_CST);
+    }
+
+    syncprof_wait(l->prof_read, start);
+}
+
+/*
+ * The last reader out lets a waiting writer in.
+ */
+void rwlock_rdunlock(struct rwlock *l)
+{
+    syncprof_signal(l->prof_read, 1);
+    if (__atomic_sub_fetch(&l->state, 1, __ATOMIC_SEQ_CST) == 0)
+        wake_up(&l->writers_sleeping, &l->writers_wake, 1);
+}
+
+/*
+ * Returns 0 if the lock was taken for writing, -1 if it is held.
+ */
+int rwlock_trywrlock(struct rwlock *l)
+{
+    int state = 0;
+
+    return __atomic_compare_exchange_n(&l->state, &state, RWLOCK_WRITER, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? 0 : -1;
+}
+
+void rwlock_wrlock(struct rwlock *l)
+{
+    int state, wake;
+    long start = 0;
+
+    if (l->prof_write >= 0)
+        start = syncprof_now();
+
+    /* From now on, no new readers get in */
+    __atomic_fetch_add(&l->writers_waiting, 1, __ATOMIC_SEQ_CST);
+
+    while (rwlock_trywrlock(l) < 0) {
+        state = __atomic_load_n(&l->state, __ATOMIC_SEQ_CST);
+        if (futex_spin(&l->state, state, &l->spin))
+            continue;
+
+        wake = __atomic_load_n(&l->writers_wake, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&l->writers_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&l->state, __ATOMIC_SEQ_CST) != 0)
+            futex_wait(&l->writers_wake, wake, NULL);
+        __atomic_fetch_sub(&l->writers_sleeping, 1, __ATOMIC_SEQ_CST);
+    }
+
+    __atomic_fetch_sub(&l->writers_waiting, 1, __ATOMIC_SEQ_CST);
+    syncprof_wait(l->prof_write, start);
+}
+
+/*
+ * Hand the lock to the next writer if there is one,
+ * otherwise to all the readers waiting for it.
+ */
+void rwlock_wrunlock(struct rwlock *l)
+{
+    syncprof_signal(l->prof_write, 1);
+    __atomic_store_n(&l->state, 0, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&l->writers_waiting, __ATOMIC_SEQ_CST) > 0)
+        wake_up(&l->writers_sleeping, &l->writers_wake, 1);
+    else
+        wake_up(&l->readers_sleeping, &l->readers_wake, INT_MAX);
+}
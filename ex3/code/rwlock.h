@@ -0,0 +1,49 @@
+/*
+ * rwlock.h
+ *
+ * A reader-writer lock for processes sharing memory.
+ *
+ * Any number of readers, or a single writer, may hold the lock.
+ * Writers are preferred: once a writer is waiting, new readers
+ * wait until no writer is left, so that a steady stream of
+ * readers cannot starve writers.
+ *
+ * Taking and releasing an uncontended lock is a single atomic
+ * operation; futex(2) is only called to sleep and to wake up.
+ */
+
+#ifndef RWLOCK_H__
+#define RWLOCK_H__
+
+/* state is the number of readers holding the lock, or RWLOCK_WRITER */
+#define RWLOCK_WRITER (1 << 30)
+
+struct rwlock {
+	int state;
+	int writers_waiting;	/* waiting or about to take the lock */
+
+	/* Sleepers, and the futex words they sleep on */
+	int readers_sleeping;
+	int readers_wake;
+	int writers_sleeping;
+	int writers_wake;
+
+	int spin;		/* see futex_spin() */
+
+	/* Slots in the contention profiler, or -1 */
+	int prof_read;
+	int prof_write;
+};
+
+/*
+ * Function prototypes
+ */
+void rwlock_init(struct rwlock *l);
+void rwlock_rdlock(struct rwlock *l);
+int rwlock_tryrdlock(struct rwlock *l);
+void rwlock_rdunlock(struct rwlock *l);
+void rwlock_wrlock(struct rwlock *l);
+int rwlock_trywrlock(struct rwlock *l);
+void rwlock_wrunlock(struct rwlock *l);
+
+#endif /* RWLOCK_H__ */
@@ -0,0 +1,188 @@
+/*
+ * shm-arena.c
+ *
+ * The free lists are Treiber stacks of offsets. Every push and pop
+ * bumps the tag next to the head, so a pop that read the next
+ * pointer of a block which was meanwhile taken and freed again
+ * fails its compare-and-swap instead of corrupting the list.
+ * The next pointer it read may be garbage, but it is still memory
+ * of the arena, which is never unmapped while in use.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "proc-common.h"
+#include "shm-arena.h"
+
+#define SHM_ARENA_MAGIC 0x5a4d4853	/* "SHMZ" */
+
+/*
+ * Every block starts with a header, which also keeps the
+ * blocks after it 16-byte aligned.
+ */
+struct shm_block {
+	uint32_t magic;
+	uint32_t cls;
+	shm_off_t next;		/* while on a free list */
+	uint32_t unused;
+};
+
+/* Blocks start after the arena header, on a cache line */
+#define SHM_ARENA_START ((sizeof(struct shm_arena) + 63) & ~(size_t) 63)
+
+/*
+ * Offsets are 32 bits, so that is as large as an arena gets.
+ */
+static void check_size(size_t size)
+{
+    if (size <= SHM_ARENA_START || size > UINT32_MAX) {
+        fprintf(stderr, "shm_arena: bad arena size %zu\n", size);
+        exit(1);
+    }
+}
+
+/*
+ * Create an arena of size bytes, usable by all descendants
+ * of the calling process.
+ */
+struct shm_arena *shm_arena_create(size_t size)
+{
+    struct shm_arena *a;
+
+    check_size(size);
+    a = create_shared_memory_area(size);
+    shm_arena_init(a, size);
+    return a;
+}
+
+/*
+ * Set up an arena in size bytes of memory that is already shared,
+ * before any process uses it.
+ */
+void shm_arena_init(struct shm_arena *a, size_t size)
+{
+    int i;
+
+    check_size(size);
+    a->size = size;
+    a->top = SHM_ARENA_START;
+    for (i = 0; i < SHM_ARENA_CLASSES; i++)
+        a->free_list[i] = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/*
+ * Unmap an arena made by shm_arena_create().
+ */
+void shm_arena_destroy(struct shm_arena *a)
+{
+    if (munmap(a, a->size) < 0)
+        perror("shm_arena_destroy: munmap");
+}
+
+static struct shm_block *block_at(struct shm_arena *a, shm_off_t off)
+{
+    return (struct shm_block *) ((char *) a + off);
+}
+
+static void push(struct shm_arena *a, int cls, shm_off_t off)
+{
+    uint64_t head, new;
+
+    head = __atomic_load_n(&a->free_list[cls], __ATOMIC_ACQUIRE);
+    do {
+        block_at(a, off)->next = (shm_off_t) head;
+        new = ((head >> 32) + 1) << 32 | off;
+    } while (!__atomic_compare_exchange_n(&a->free_list[cls], &head, new, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+static shm_off_t pop(struct shm_arena *a, int cls)
+{
+    uint64_t head, new;
+    shm_off_t off;
+
+    head = __atomic_load_n(&a->free_list[cls], __ATOMIC_ACQUIRE);
+    do {
+        off = (shm_off_t) head;
+        if (off == 0)
+            return 0;
+        new = ((head >> 32) + 1) << 32 |
+              __atomic_load_n(&block_at(a, off)->next, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&a->free_list[cls], &head, new, 1,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return off;
+}
+
+/*
+ * Allocate size bytes, 16-byte aligned.
+ * Returns NULL if the arena is exhausted.
+ */
+void *shm_arena_alloc(struct shm_arena *a, size_t size)
+{
+    struct shm_block *b;
+    uint64_t top, block;
+    shm_off_t off;
+    int cls;
+
+    /* Also keeps size + header from wrapping around */
+    if (size > (1UL << (SHM_ARENA_CLASSES - 1 + SHM_ARENA_MIN_SHIFT)) - sizeof(struct shm_block))
+        return NULL;
+
+    for (cls = 0; cls < SHM_ARENA_CLASSES; cls++) {
+        if ((1UL << (cls + SHM_ARENA_MIN_SHIFT)) >= size + sizeof(struct shm_block))
+            break;
+    }
+    if (cls == SHM_ARENA_CLASSES)
+        return NULL;
+
+    off = pop(a, cls);
+    if (off == 0) {
+        /* Only move the end of the used part if the block fits */
+        block = 1UL << (cls + SHM_ARENA_MIN_SHIFT);
+        top = __atomic_load_n(&a->top, __ATOMIC_RELAXED);
+        do {
+            if (top + block > a->size)
+                return NULL;
+        } while (!__atomic_compare_exchange_n(&a->top, &top, top + block, 1,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        off = top;
+    }
+
+    b = block_at(a, off);
+    b->magic = SHM_ARENA_MAGIC;
+    b->cls = cls;
+    return b + 1;
+}
+
+void shm_arena_free(struct shm_arena *a, void *ptr)
+{
+    struct shm_block *b;
+
+    if (ptr == NULL)
+        return;
+
+    b = (struct shm_block *) ptr - 1;
+    if (b->magic != SHM_ARENA_MAGIC || b->cls >= SHM_ARENA_CLASSES) {
+        fprintf(stderr, "%s: %p was not allocated from the arena\n", __func__, ptr);
+        abort();
+    }
+    push(a, b->cls, shm_arena_off(a, b));
+}
+
+/*
+ * Convert between pointers into the arena, as mapped by
+ * the calling process, and offsets from its start.
+ */
+shm_off_t shm_arena_off(struct shm_arena *a, const void *ptr)
+{
+    return ptr == NULL ? 0 : (shm_off_t) ((const char *) ptr - (const char *) a);
+}
+
+void *shm_arena_ptr(struct shm_arena *a, shm_off_t off)
+{
+    return off == 0 ? NULL : (char *) a + off;
+}
@@ -0,0 +1,54 @@
+/*
+ * shm-arena.h
+ *
+ * An allocator for memory shared between processes:
+ * one large shared mapping, handed out in blocks that any
+ * of the processes can allocate and free.
+ *
+ * Blocks come in power-of-two size classes, from 32 bytes up to
+ * 2GiB, each including a 16 byte header; the smallest holds 16 bytes
+ * of data. A request for more than 2GiB minus the header fails.
+ * A freed block goes on the
+ * free list of its class, and is reused for the next block of the
+ * same class; new blocks are carved from the end of the used part
+ * of the arena. Free lists and the end of the used part are only
+ * touched with atomic operations, so no process ever blocks
+ * another, and no system call is made after shm_arena_create().
+ *
+ * Shared structures should point into the arena with offsets
+ * (shm_off_t) from its start rather than with pointers, so that
+ * they stay valid wherever the arena is mapped.
+ */
+
+#ifndef SHM_ARENA_H__
+#define SHM_ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_ARENA_MIN_SHIFT 5
+#define SHM_ARENA_CLASSES   27	/* 32 bytes up to 2GiB */
+
+/* Offset of a block from the start of the arena; 0 means none */
+typedef uint32_t shm_off_t;
+
+struct shm_arena {
+	uint64_t size;				/* of the whole arena */
+	uint64_t top;				/* end of the used part */
+
+	/* Head offset in the low half, ABA tag in the high half */
+	uint64_t free_list[SHM_ARENA_CLASSES];
+};
+
+/*
+ * Function prototypes
+ */
+struct shm_arena *shm_arena_create(size_t size);
+void shm_arena_init(struct shm_arena *a, size_t size);
+void shm_arena_destroy(struct shm_arena *a);
+void *shm_arena_alloc(struct shm_arena *a, size_t size);
+void shm_arena_free(struct shm_arena *a, void *ptr);
+shm_off_t shm_arena_off(struct shm_arena *a, const void *ptr);
+void *shm_arena_ptr(struct shm_arena *a, shm_off_t off);
+
+#endif /* SHM_ARENA_H__ */
@@ -0,0 +1,125 @@
+/*
+ * shm-atomic.c
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <sched.h>
+
+#include "futex.h"
+#include "shm-atomic.h"
+
+/*
+ * Spins of a writer or reader waiting for a writer
+ * to finish, before it gives up the CPU to let it run.
+ */
+#define SEQLOCK_SPINS 64
+
+static void backoff(int *spins)
+{
+    if (++*spins < SEQLOCK_SPINS) {
+        cpu_relax();
+    } else {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+void shm_counter_init(struct shm_counter *c, long value)
+{
+    __atomic_store_n(&c->value, value, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Add delta to the counter, and return the new value.
+ */
+long shm_counter_add(struct shm_counter *c, long delta)
+{
+    return __atomic_add_fetch(&c->value, delta, __ATOMIC_SEQ_CST);
+}
+
+long shm_counter_read(struct shm_counter *c)
+{
+    return __atomic_load_n(&c->value, __ATOMIC_SEQ_CST);
+}
+
+void seqlock_init(struct seqlock *sl)
+{
+    __atomic_store_n(&sl->seq, 0, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Become the only writer, by making seq odd.
+ */
+void seqlock_write_lock(struct seqlock *sl)
+{
+    unsigned int seq;
+    int spins = 0;
+
+    for (;;) {
+        seq = __atomic_load_n(&sl->seq, __ATOMIC_RELAXED);
+        if (!(seq & 1) &&
+            __atomic_compare_exchange_n(&sl->seq, &seq, seq + 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        backoff(&spins);
+    }
+
+    /* Our stores to the data must not be seen before seq is odd */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void seqlock_write_unlock(struct seqlock *sl)
+{
+    __atomic_store_n(&sl->seq, __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) + 1,
+                     __ATOMIC_RELEASE);
+}
+
+/*
+ * Wait until no writer is active,
+ * and return the sequence number to pass to seqlock_read_retry().
+ */
+unsigned int seqlock_read_begin(struct seqlock *sl)
+{
+    unsigned int seq;
+    int spins = 0;
+
+    while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1)
+        backoff(&spins);
+    return seq;
+}
+
+/*
+ * Returns nonzero if a writer has been active
+ * since seqlock_read_begin() returned start,
+ * in which case what was read must be thrown away.
+ */
+int seqlock_read_retry(struct seqlock *sl, unsigned int start)
+{
+    /* Our loads from the data must complete before we look at seq */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != start;
+}
+
+/*
+ * Copy size bytes from src to the protected dst.
+ */
+void seqlock_write(struct seqlock *sl, void *dst, const void *src, size_t size)
+{
+    seqlock_write_lock(sl);
+    memcpy(dst, src, size);
+    seqlock_write_unlock(sl);
+}
+
+/*
+ * Take a consistent copy of the protected src into dst.
+ */
+void seqlock_read(struct seqlock *sl, void *dst, const void *src, size_t size)
+{
+    unsigned int seq;
+
+    do {
+        seq = seqlock_read_begin(sl);
+        memcpy(dst, src, size);
+    } while (seqlock_read_retry(sl, seq));
+}
@@ -0,0 +1,53 @@
+/*
+ * shm-atomic.h
+ *
+ * Lock-free building blocks for data in memory shared between
+ * processes: counters updated with atomic fetch-and-add, and
+ * sequence locks for values that span several words.
+ *
+ * Neither makes a system call: seqlock readers never block
+ * writers, and retry if a writer got in their way.
+ */
+
+#ifndef SHM_ATOMIC_H__
+#define SHM_ATOMIC_H__
+
+#include <stddef.h>
+
+#define SHM_ATOMIC_CACHELINE 64
+
+/*
+ * A counter on a cache line of its own,
+ * so that counters next to each other do not slow each other down.
+ */
+struct shm_counter {
+	long value __attribute__((aligned(SHM_ATOMIC_CACHELINE)));
+};
+
+/*
+ * A sequence lock: seq is odd while a writer is updating
+ * the data it protects, and changes with every update.
+ *
+ * Writers are serialized among themselves; readers take a copy
+ * of the data and check that seq did not change meanwhile.
+ */
+struct seqlock {
+	unsigned int seq __attribute__((aligned(SHM_ATOMIC_CACHELINE)));
+};
+
+/*
+ * Function prototypes
+ */
+void shm_counter_init(struct shm_counter *c, long value);
+long shm_counter_add(struct shm_counter *c, long delta);
+long shm_counter_read(struct shm_counter *c);
+
+void seqlock_init(struct seqlock *sl);
+void seqlock_write_lock(struct seqlock *sl);
+void seqlock_write_unlock(struct seqlock *sl);
+unsigned int seqlock_read_begin(struct seqlock *sl);
+int seqlock_read_retry(struct seqlock *sl, unsigned int start);
+void seqlock_write(struct seqlock *sl, void *dst, const void *src, size_t size);
+void seqlock_read(struct seqlock *sl, void *dst, const void *src, size_t size);
+
+#endif /* SHM_ATOMIC_H__ */
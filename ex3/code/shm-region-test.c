@@ -0,0 +1,154 @@
+/*
+ * shm-region-test.c
+ *
+ * A program to verify correct operation of shm-region:
+ * a region is created, then attached to by other processes, read-write
+ * and read-only, by name and through a memfd; attaching with the wrong
+ * version, or after the name is gone, must fail.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "proc-common.h"
+#include "shm-region.h"
+
+#define REGION_TEST_VERSION 3
+#define REGION_TEST_SIZE 8192
+
+int failed = 0;
+
+void check(int ok, const char *what)
+{
+	printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+	if (!ok)
+		failed = 1;
+}
+
+/*
+ * Run fn(arg) in a child, and return its wait status.
+ */
+int in_child(int (*fn)(const char *), const char *arg)
+{
+	int status;
+	pid_t p;
+
+	fflush(stdout);
+	p = fork();
+	if (p < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (p == 0)
+		exit(fn(arg));
+	waitpid(p, &status, 0);
+	return status;
+}
+
+/* Attach read-write, check what the creator wrote, and answer */
+int writer(const char *name)
+{
+	size_t size;
+	char *data = shm_region_attach(name, REGION_TEST_VERSION, 0, &size);
+
+	if (data == NULL || size != REGION_TEST_SIZE || strcmp(data, "hello") != 0)
+		return 1;
+	strcpy(data + size / 2, "hello back");
+	shm_region_detach(data);
+	return 0;
+}
+
+/* Attach read-only, see the data, then write to it, which must fault */
+int reader(const char *name)
+{
+	char *data = shm_region_attach(name, REGION_TEST_VERSION, SHM_REGION_RDONLY, NULL);
+
+	if (data == NULL || strcmp(data, "hello") != 0)
+		return 1;
+	data[0] = 'j';
+	return 2;
+}
+
+int wrong_version(const char *name)
+{
+	return shm_region_attach(name, REGION_TEST_VERSION + 1, 0, NULL) == NULL ? 0 : 1;
+}
+
+int gone(const char *name)
+{
+	return shm_region_attach(name, REGION_TEST_VERSION, 0, NULL) == NULL ? 0 : 1;
+}
+
+/* Open a memfd through /proc, as a process that did not inherit it would */
+int memfd_reader(const char *path)
+{
+	char *data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	data = shm_region_attach_fd(fd, REGION_TEST_VERSION, SHM_REGION_RDONLY, NULL);
+	close(fd);
+	return data != NULL && strcmp(data, "memfd") == 0 ? 0 : 1;
+}
+
+int main(void)
+{
+	char name[64], path[64];
+	char *data;
+	int status, fd;
+
+	snprintf(name, sizeof(name), "/shm-region-test-%ld", (long) getpid());
+	data = shm_region_create(name, REGION_TEST_VERSION, REGION_TEST_SIZE);
+	if (data == NULL)
+		exit(1);
+	strcpy(data, "hello");
+
+	check(shm_region_create(name, REGION_TEST_VERSION, REGION_TEST_SIZE) == NULL,
+	      "creating it twice fails");
+
+	status = in_child(writer, name);
+	check(WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+	      strcmp(data + REGION_TEST_SIZE / 2, "hello back") == 0,
+	      "read-write attach by name");
+
+	status = in_child(reader, name);
+	check(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV && data[0] == 'h',
+	      "read-only attach by name");
+
+	status = in_child(wrong_version, name);
+	check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "wrong version refused");
+
+	shm_region_unlink(name);
+	status = in_child(gone, name);
+	check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "attach after unlink fails");
+	check(strcmp(data, "hello") == 0, "creator keeps the data after unlink");
+	shm_region_detach(data);
+
+	data = shm_region_create_memfd("shm-region-test", REGION_TEST_VERSION, 64, &fd);
+	if (data == NULL)
+		exit(1);
+	strcpy(data, "memfd");
+	snprintf(path, sizeof(path), "/proc/%ld/fd/%d", (long) getpid(), fd);
+	status = in_child(memfd_reader, path);
+	check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "read-only attach to a memfd");
+	shm_region_detach(data);
+	close(fd);
+
+	if (failed) {
+		printf("Region test failed.\n");
+		exit(1);
+	}
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * shm-region.c
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "shm-region.h"
+
+/*
+ * Size fd for a region of size bytes of data,
+ * map it and fill in the header.
+ */
+static void *init_region(int fd, const char *name, uint32_t version, size_t size)
+{
+    struct shm_region_header *h;
+
+    if (ftruncate(fd, sizeof(*h) + size) < 0) {
+        perror(name);
+        return NULL;
+    }
+
+    h = mmap(NULL, sizeof(*h) + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED) {
+        perror(name);
+        return NULL;
+    }
+
+    h->version = version;
+    h->size = size;
+    h->creator = getpid();
+    __atomic_store_n(&h->magic, SHM_REGION_MAGIC, __ATOMIC_RELEASE);
+
+    return h + 1;
+}
+
+/*
+ * Create a region called name ("/something", see shm_overview(7)),
+ * with size bytes of zeroed data. Fails if it already exists.
+ */
+void *shm_region_create(const char *name, uint32_t version, size_t size)
+{
+    void *data;
+    int fd;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        perror(name);
+        return NULL;
+    }
+
+    data = init_region(fd, name, version, size);
+    close(fd);
+    if (data == NULL)
+        shm_unlink(name);
+    return data;
+}
+
+/*
+ * Same, for a region with no name in the file system, which goes away
+ * with its last user. *fd is left open, to be passed to other processes
+ * over a Unix socket, or opened by them as /proc/<pid>/fd/<fd>.
+ */
+void *shm_region_create_memfd(const char *name, uint32_t version, size_t size, int *fd)
+{
+    void *data;
+
+    *fd = memfd_create(name, MFD_CLOEXEC);
+    if (*fd < 0) {
+        perror(name);
+        return NULL;
+    }
+
+    data = init_region(*fd, name, version, size);
+    if (data == NULL) {
+        close(*fd);
+        *fd = -1;
+    }
+    return data;
+}
+
+/*
+ * Attach to the region behind fd, if it holds data of the given
+ * version. The size of the data is stored in *size, if not NULL.
+ * With SHM_REGION_RDONLY, fd only needs to be open for reading.
+ */
+void *shm_region_attach_fd(int fd, uint32_t version, int flags, size_t *size)
+{
+    struct shm_region_header *h;
+    struct stat st;
+    size_t total;
+
+    if (fstat(fd, &st) < 0) {
+        perror("shm_region_attach_fd: fstat");
+        return NULL;
+    }
+    if (st.st_size < sizeof(*h)) {
+        fprintf(stderr, "%s: region too small for a header\n", __func__);
+        return NULL;
+    }
+
+    h = mmap(NULL, sizeof(*h), PROT_READ, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED) {
+        perror("shm_region_attach_fd: mmap");
+        return NULL;
+    }
+
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SHM_REGION_MAGIC) {
+        fprintf(stderr, "%s: not a region, or not ready yet\n", __func__);
+        goto out_unmap;
+    }
+    if (h->version != version) {
+        fprintf(stderr, "%s: region has version %u, expected %u\n",
+            __func__, h->version, version);
+        goto out_unmap;
+    }
+    total = sizeof(*h) + h->size;
+    if (total > st.st_size) {
+        fprintf(stderr, "%s: region says %zu bytes, but is only %zu\n",
+            __func__, total, (size_t) st.st_size);
+        goto out_unmap;
+    }
+    munmap(h, sizeof(*h));
+
+    h = mmap(NULL, total, (flags & SHM_REGION_RDONLY) ? PROT_READ : PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED) {
+        perror("shm_region_attach_fd: mmap");
+        return NULL;
+    }
+    if (size != NULL)
+        *size = h->size;
+    return h + 1;
+
+out_unmap:
+    munmap(h, sizeof(*h));
+    return NULL;
+}
+
+void *shm_region_attach(const char *name, uint32_t version, int flags, size_t *size)
+{
+    void *data;
+    int fd;
+
+    fd = shm_open(name, (flags & SHM_REGION_RDONLY) ? O_RDONLY : O_RDWR, 0);
+    if (fd < 0) {
+        perror(name);
+        return NULL;
+    }
+
+    data = shm_region_attach_fd(fd, version, flags, size);
+    close(fd);
+    return data;
+}
+
+/*
+ * Unmap a region from the calling process.
+ * The region itself stays around for the others.
+ */
+void shm_region_detach(void *data)
+{
+    struct shm_region_header *h = (struct shm_region_header *) data - 1;
+
+    if (munmap(h, sizeof(*h) + h->size) < 0)
+        perror("shm_region_detach: munmap");
+}
+
+/*
+ * Remove the name of a region; it goes away
+ * once no process has it attached.
+ */
+int shm_region_unlink(const char *name)
+{
+    int status;
+
+    status = shm_unlink(name);
+    if (status < 0)
+        perror(name);
+    return status;
+}
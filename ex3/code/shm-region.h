@@ -0,0 +1,51 @@
+/*
+ * shm-region.h
+ *
+ * Named shared memory regions, which unrelated processes
+ * can attach to: a monitor, a benchmark driver, or a program
+ * started from another shell.
+ *
+ * A region is a POSIX shared memory object (shm_open(3)) or a
+ * memfd (memfd_create(2)), starting with a header that says
+ * what it holds: a magic number, the version of the layout of
+ * the data, chosen by the creator, and the size of the data.
+ * Attaching checks all three, so a stale region or one left by
+ * an older build of a tool is refused instead of misread.
+ *
+ * The functions return a pointer to the data, after the header,
+ * or NULL after printing why the region could not be used.
+ * Processes that only look at a region, such as monitors, attach
+ * with SHM_REGION_RDONLY: they get a read-only mapping, and only
+ * need read permission on the object.
+ */
+
+#ifndef SHM_REGION_H__
+#define SHM_REGION_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_REGION_MAGIC 0x4e474552	/* "REGN" */
+
+/* Flags for shm_region_attach() and shm_region_attach_fd() */
+#define SHM_REGION_RDONLY 0x1
+
+struct shm_region_header {
+	uint32_t magic;		/* set last, once the header is valid */
+	uint32_t version;
+	uint64_t size;		/* of the data, after the header */
+	int32_t creator;	/* pid */
+	char pad[44];		/* keep the data on a cache line */
+};
+
+/*
+ * Function prototypes
+ */
+void *shm_region_create(const char *name, uint32_t version, size_t size);
+void *shm_region_create_memfd(const char *name, uint32_t version, size_t size, int *fd);
+void *shm_region_attach(const char *name, uint32_t version, int flags, size_t *size);
+void *shm_region_attach_fd(int fd, uint32_t version, int flags, size_t *size);
+void shm_region_detach(void *data);
+int shm_region_unlink(const char *name);
+
+#endif /* SHM_REGION_H__ */
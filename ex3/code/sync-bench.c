@@ -0,0 +1,523 @@
+/*
+ * sync-bench.c
+ *
+ * A program to measure the cost of synchronization primitives
+ * between processes:
+ *
+ *  - pipesem over a pipe, an eventfd and a futex,
+ *  - process-shared POSIX semaphores,
+ *  - a semaphore built on a process-shared pthread mutex and condvar.
+ *
+ * For every primitive it measures:
+ *
+ *  - ping-pong: round trip time between two processes
+ *    signaling each other through two semaphores,
+ *  - contention: total throughput of 1..N processes using
+ *    one semaphore as a lock around a shared counter,
+ *  - wakeup: time from a signal to the return of the
+ *    wait of a process that was asleep on the semaphore,
+ *  - A/B/C: cycles per second of the proc_A/proc_B/proc_C
+ *    pattern of ask3-3, without the printing.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "proc-common.h"
+#include "pipesem.h"
+
+#define MAX_PROCS 64
+
+enum {
+    BSEM_PIPE,
+    BSEM_EVENTFD,
+    BSEM_FUTEX,
+    BSEM_POSIX,
+    BSEM_CONDVAR,
+    BSEM_KINDS
+};
+
+static const char *bsem_names[BSEM_KINDS] = {
+    "pipe", "eventfd", "futex", "posix-sem", "mutex+cond"
+};
+
+/*
+ * A counting semaphore out of a process-shared mutex and condvar.
+ */
+struct condsem {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int value;
+};
+
+/*
+ * A semaphore of any kind. The struct itself may be copied
+ * by fork(); everything that must be shared is in shared memory.
+ */
+struct bsem {
+    int kind;
+    struct pipesem ps;
+    sem_t *posix;
+    struct condsem *cond;
+};
+
+void bsem_init(struct bsem *b, int kind, int val)
+{
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+
+    b->kind = kind;
+    switch (kind) {
+        case BSEM_PIPE:
+            pipesem_init_backend(&b->ps, val, PIPESEM_PIPE);
+            break;
+        case BSEM_EVENTFD:
+            pipesem_init_backend(&b->ps, val, PIPESEM_EVENTFD);
+            break;
+        case BSEM_FUTEX:
+            pipesem_init_backend(&b->ps, val, PIPESEM_FUTEX);
+            break;
+        case BSEM_POSIX:
+            b->posix = create_shared_memory_area(sizeof(sem_t));
+            if (sem_init(b->posix, 1, val) < 0) {
+                perror("sem_init");
+                exit(1);
+            }
+            break;
+        case BSEM_CONDVAR:
+            b->cond = create_shared_memory_area(sizeof(struct condsem));
+            pthread_mutexattr_init(&mattr);
+            pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+            pthread_mutex_init(&b->cond->mutex, &mattr);
+            pthread_condattr_init(&cattr);
+            pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+            pthread_cond_init(&b->cond->cond, &cattr);
+            b->cond->value = val;
+            break;
+    }
+}
+
+void bsem_wait(struct bsem *b)
+{
+    switch (b->kind) {
+        case BSEM_POSIX:
+            while (sem_wait(b->posix) < 0)
+                ;
+            break;
+        case BSEM_CONDVAR:
+            pthread_mutex_lock(&b->cond->mutex);
+            while (b->cond->value == 0)
+                pthread_cond_wait(&b->cond->cond, &b->cond->mutex);
+            b->cond->value--;
+            pthread_mutex_unlock(&b->cond->mutex);
+            break;
+        default:
+            pipesem_wait(&b->ps);
+    }
+}
+
+void bsem_signal(struct bsem *b)
+{
+    switch (b->kind) {
+        case BSEM_POSIX:
+            sem_post(b->posix);
+            break;
+        case BSEM_CONDVAR:
+            pthread_mutex_lock(&b->cond->mutex);
+            b->cond->value++;
+            pthread_cond_signal(&b->cond->cond);
+            pthread_mutex_unlock(&b->cond->mutex);
+            break;
+        default:
+            pipesem_signal(&b->ps);
+    }
+}
+
+void bsem_destroy(struct bsem *b)
+{
+    long page = sysconf(_SC_PAGE_SIZE);
+
+    switch (b->kind) {
+        case BSEM_POSIX:
+            sem_destroy(b->posix);
+            munmap(b->posix, page);
+            break;
+        case BSEM_CONDVAR:
+            pthread_cond_destroy(&b->cond->cond);
+            pthread_mutex_destroy(&b->cond->mutex);
+            munmap(b->cond, page);
+            break;
+        default:
+            pipesem_destroy(&b->ps);
+    }
+}
+
+double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+pid_t spawn(void (*fn)(void *), void *arg)
+{
+    pid_t p;
+
+    /* Do not let the child flush our half-printed table line */
+    fflush(stdout);
+    p = fork();
+    if (p < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (p == 0) {
+        fn(arg);
+        exit(0);
+    }
+    return p;
+}
+
+void wait_all(int n)
+{
+    int status;
+    pid_t p;
+
+    for (; n > 0; n--) {
+        p = wait(&status);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            explain_wait_status(p, status);
+            exit(1);
+        }
+    }
+}
+
+/*************
+ * Ping-pong *
+ *************/
+
+struct pingpong {
+    struct bsem ping, pong;
+    long iters;
+};
+
+void ponger(void *arg)
+{
+    struct pingpong *pp = arg;
+    long i;
+
+    for (i = 0; i < pp->iters; i++) {
+        bsem_wait(&pp->ping);
+        bsem_signal(&pp->pong);
+    }
+}
+
+/* Returns nanoseconds per round trip */
+double bench_pingpong(int kind, long iters)
+{
+    struct pingpong pp;
+    double start, end;
+    long i;
+
+    bsem_init(&pp.ping, kind, 0);
+    bsem_init(&pp.pong, kind, 0);
+    pp.iters = iters;
+
+    spawn(ponger, &pp);
+    start = now_ns();
+    for (i = 0; i < iters; i++) {
+        bsem_signal(&pp.ping);
+        bsem_wait(&pp.pong);
+    }
+    end = now_ns();
+    wait_all(1);
+
+    bsem_destroy(&pp.ping);
+    bsem_destroy(&pp.pong);
+    return (end - start) / iters;
+}
+
+/**************
+ * Contention *
+ **************/
+
+struct contention {
+    struct bsem lock;
+    struct bsem go;
+    volatile long *counter;
+    long iters;
+};
+
+void contender(void *arg)
+{
+    struct contention *c = arg;
+    long i;
+
+    bsem_wait(&c->go);
+    for (i = 0; i < c->iters; i++) {
+        bsem_wait(&c->lock);
+        *c->counter = *c->counter + 1;
+        bsem_signal(&c->lock);
+    }
+}
+
+/* Returns lock acquisitions per second, over all processes */
+double bench_contention(int kind, int nprocs, long iters)
+{
+    struct contention c;
+    double start, end;
+    int i;
+
+    bsem_init(&c.lock, kind, 1);
+    bsem_init(&c.go, BSEM_PIPE, 0);
+    c.counter = create_shared_memory_area(sizeof(long));
+    *c.counter = 0;
+    c.iters = iters;
+
+    for (i = 0; i < nprocs; i++)
+        spawn(contender, &c);
+    start = now_ns();
+    pipesem_signal_n(&c.go.ps, nprocs);
+    wait_all(nprocs);
+    end = now_ns();
+
+    if (*c.counter != nprocs * iters) {
+        fprintf(stderr, "%s: lost updates: %ld != %ld\n",
+            bsem_names[kind], *c.counter, nprocs * iters);
+        exit(1);
+    }
+
+    bsem_destroy(&c.lock);
+    bsem_destroy(&c.go);
+    munmap((void *) c.counter, sysconf(_SC_PAGE_SIZE));
+    return nprocs * iters / ((end - start) / 1e9);
+}
+
+/**********
+ * Wakeup *
+ **********/
+
+struct wakeup {
+    struct bsem sem;
+    struct bsem ack;
+    volatile double *signaled;  /* when the signal was sent */
+    volatile double *latency;   /* one sample per round */
+    int samples;
+};
+
+void sleeper(void *arg)
+{
+    struct wakeup *w = arg;
+    int i;
+
+    for (i = 0; i < w->samples; i++) {
+        bsem_wait(&w->sem);
+        w->latency[i] = now_ns() - *w->signaled;
+        bsem_signal(&w->ack);
+    }
+}
+
+/*
+ * Signal a process that has had time to fall asleep,
+ * and see how long it takes to wake up.
+ * Returns the average and maximum latency in nanoseconds.
+ */
+void bench_wakeup(int kind, int samples, double *avg, double *max)
+{
+    struct wakeup w;
+    struct timespec gap = { 0, 200000 };
+    int i;
+
+    bsem_init(&w.sem, kind, 0);
+    bsem_init(&w.ack, kind, 0);
+    w.signaled = create_shared_memory_area(sizeof(double));
+    w.latency = create_shared_memory_area(samples * sizeof(double));
+    w.samples = samples;
+
+    spawn(sleeper, &w);
+    for (i = 0; i < samples; i++) {
+        nanosleep(&gap, NULL);
+        *w.signaled = now_ns();
+        bsem_signal(&w.sem);
+        bsem_wait(&w.ack);
+    }
+    wait_all(1);
+
+    *avg = *max = 0;
+    for (i = 0; i < samples; i++) {
+        *avg += w.latency[i] / samples;
+        if (w.latency[i] > *max)
+            *max = w.latency[i];
+    }
+
+    bsem_destroy(&w.sem);
+    bsem_destroy(&w.ack);
+    munmap((void *) w.signaled, sysconf(_SC_PAGE_SIZE));
+    munmap((void *) w.latency, samples * sizeof(double));
+}
+
+/*********
+ * A/B/C *
+ *********/
+
+struct abc {
+    struct bsem sem[3];
+    volatile int *n;
+    long cycles;
+};
+
+/* Proc A: n = n + 1, twice per cycle */
+void abc_A(void *arg)
+{
+    struct abc *a = arg;
+    long i;
+
+    for (i = 0; i < 2 * a->cycles; i++) {
+        bsem_wait(&a->sem[2]);
+        *a->n = *a->n + 1;
+        bsem_signal(&a->sem[0]);
+    }
+}
+
+/* Proc B: n = n - 2 */
+void abc_B(void *arg)
+{
+    struct abc *a = arg;
+    long i;
+
+    for (i = 0; i < a->cycles; i++) {
+        bsem_wait(&a->sem[0]);
+        bsem_wait(&a->sem[0]);
+        *a->n = *a->n - 2;
+        bsem_signal(&a->sem[1]);
+    }
+}
+
+/* Proc C: check that n == 1 */
+void abc_C(void *arg)
+{
+    struct abc *a = arg;
+    long i;
+
+    for (i = 0; i < a->cycles; i++) {
+        bsem_wait(&a->sem[1]);
+        if (*a->n != 1) {
+            fprintf(stderr, "Proc C: n = %d ...Aaaaaargh!\n", *a->n);
+            exit(1);
+        }
+        bsem_signal(&a->sem[2]);
+        bsem_signal(&a->sem[2]);
+    }
+}
+
+/* Returns nanoseconds per cycle */
+double bench_abc(int kind, long cycles)
+{
+    struct abc a;
+    double start, end;
+    int i;
+
+    bsem_init(&a.sem[0], kind, 0);
+    bsem_init(&a.sem[1], kind, 1);
+    bsem_init(&a.sem[2], kind, 0);
+    a.n = create_shared_memory_area(sizeof(int));
+    *a.n = 1;
+    a.cycles = cycles;
+
+    start = now_ns();
+    spawn(abc_A, &a);
+    spawn(abc_B, &a);
+    spawn(abc_C, &a);
+    wait_all(3);
+    end = now_ns();
+
+    for (i = 0; i < 3; i++)
+        bsem_destroy(&a.sem[i]);
+    munmap((void *) a.n, sysconf(_SC_PAGE_SIZE));
+    return (end - start) / cycles;
+}
+
+void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-i iterations] [-p max_procs] [primitive...]\n\n"
+        "  -i  round trips / lock acquisitions per process / A-B-C cycles (default 20000)\n"
+        "  -p  largest number of contending processes (default 4)\n"
+        "  primitives: pipe eventfd futex posix-sem mutex+cond (default: all)\n", argv0);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, k, opt, nprocs;
+    int max_procs = 4;
+    long iters = 20000;
+    int enabled[BSEM_KINDS];
+    double avg, max;
+
+    while ((opt = getopt(argc, argv, "i:p:")) != -1) {
+        switch (opt) {
+            case 'i':
+                iters = atol(optarg);
+                if (iters <= 0)
+                    usage(argv[0]);
+                break;
+            case 'p':
+                max_procs = atoi(optarg);
+                if (max_procs <= 0 || max_procs > MAX_PROCS)
+                    usage(argv[0]);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    for (k = 0; k < BSEM_KINDS; k++)
+        enabled[k] = optind == argc;
+    for (i = optind; i < argc; i++) {
+        for (k = 0; k < BSEM_KINDS; k++) {
+            if (strcmp(argv[i], bsem_names[k]) == 0)
+                break;
+        }
+        if (k == BSEM_KINDS)
+            usage(argv[0]);
+        enabled[k] = 1;
+    }
+
+    printf("%-12s %14s %14s %14s %14s\n", "primitive",
+        "pingpong ns", "wakeup avg us", "wakeup max us", "A/B/C ns");
+    for (k = 0; k < BSEM_KINDS; k++) {
+        if (!enabled[k])
+            continue;
+        printf("%-12s %14.0f", bsem_names[k], bench_pingpong(k, iters));
+        bench_wakeup(k, 200, &avg, &max);
+        printf(" %14.1f %14.1f", avg / 1000, max / 1000);
+        printf(" %14.0f\n", bench_abc(k, iters));
+    }
+
+    printf("\n%-12s", "ops/s");
+    for (nprocs = 1; nprocs <= max_procs; nprocs *= 2)
+        printf(" %10d proc", nprocs);
+    printf("\n");
+    for (k = 0; k < BSEM_KINDS; k++) {
+        if (!enabled[k])
+            continue;
+        printf("%-12s", bsem_names[k]);
+        for (nprocs = 1; nprocs <= max_procs; nprocs *= 2) {
+            printf(" %15.0f", bench_contention(k, nprocs, iters));
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,293 @@
+/*
+ * syncprof.c
+ *
+ * The dump may be made from a signal handler, so it is formatted
+ * by hand, a line at a time, and written with write(2): stdio and
+ * printf() are not async-signal-safe.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "syncprof.h"
+
+struct syncprof_page {
+    pid_t owner;
+    int nslots;
+    struct syncprof_slot slots[SYNCPROF_SLOTS];
+};
+
+static struct syncprof_page *page = NULL;
+static int enabled = -1;
+
+static void dump_fd(int fd);
+
+static void syncprof_atexit(void)
+{
+    if (page != NULL && getpid() == page->owner)
+        syncprof_dump(stderr);
+}
+
+/*
+ * Dump from the owner, then die of the signal as we would have.
+ * Children inherit the handler and just die.
+ */
+static void syncprof_on_signal(int sig)
+{
+    if (page != NULL && getpid() == page->owner)
+        dump_fd(STDERR_FILENO);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void catch_signal(int sig)
+{
+    struct sigaction sa;
+
+    if (sigaction(sig, NULL, &sa) == 0 && sa.sa_handler == SIG_DFL) {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = syncprof_on_signal;
+        sigaction(sig, &sa, NULL);
+    }
+}
+
+static int create_page(void)
+{
+    page = mmap(NULL, sizeof(struct syncprof_page), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) {
+        perror("syncprof: mmap");
+        page = NULL;
+        return -1;
+    }
+    page->owner = getpid();
+    page->nslots = 0;
+
+    atexit(syncprof_atexit);
+    catch_signal(SIGINT);
+    catch_signal(SIGTERM);
+    return 0;
+}
+
+/*
+ * Get a slot for a new semaphore or lock called name,
+ * or -1 if profiling is disabled or there are no slots left.
+ * Like the semaphore itself, this must happen before forking
+ * the processes that are going to use it.
+ */
+int syncprof_register(const char *name)
+{
+    int slot;
+
+    if (enabled < 0)
+        enabled = getenv("SYNCPROF") != NULL;
+    if (!enabled)
+        return -1;
+    if (page == NULL && create_page() < 0)
+        return -1;
+
+    slot = __atomic_fetch_add(&page->nslots, 1, __ATOMIC_RELAXED);
+    if (slot >= SYNCPROF_SLOTS) {
+        __atomic_store_n(&page->nslots, SYNCPROF_SLOTS, __ATOMIC_RELAXED);
+        return -1;
+    }
+    snprintf(page->slots[slot].name, SYNCPROF_NAME, "%s", name);
+    return slot;
+}
+
+long syncprof_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ * Account for a wait on slot, which started at start_ns.
+ */
+void syncprof_wait(int slot, long start_ns)
+{
+    struct syncprof_slot *s;
+    long ns, max;
+    int k;
+
+    if (slot < 0)
+        return;
+
+    s = &page->slots[slot];
+    ns = syncprof_now() - start_ns;
+    for (k = 0; k < SYNCPROF_BUCKETS - 1 && ns >= (1L << k); k++)
+        ;
+
+    __atomic_fetch_add(&s->waits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->hist[k], 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&s->max_ns, &max, ns, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void syncprof_signal(int slot, int n)
+{
+    if (slot >= 0)
+        __atomic_fetch_add(&page->slots[slot].signals, n, __ATOMIC_RELAXED);
+}
+
+/*
+ * A line of the dump, being put together.
+ */
+struct line {
+    char buf[128];
+    size_t len;
+};
+
+static void put_char(struct line *l, char c)
+{
+    if (l->len < sizeof(l->buf))
+        l->buf[l->len++] = c;
+}
+
+static void put_str(struct line *l, const char *str)
+{
+    while (*str)
+        put_char(l, *str++);
+}
+
+static void put_long(struct line *l, long val)
+{
+    char digits[24];
+    int n = 0;
+
+    if (val < 0) {
+        put_char(l, '-');
+        val = -val;
+    }
+    do {
+        digits[n++] = '0' + val % 10;
+        val /= 10;
+    } while (val > 0);
+    while (n > 0)
+        put_char(l, digits[--n]);
+}
+
+/* A time, in the largest unit it has a whole one of, to 0.1 */
+static void put_ns(struct line *l, long ns)
+{
+    static const struct {
+        long ns;
+        const char *unit;
+    } units[] = { { 1000000000, "s" }, { 1000000, "ms" }, { 1000, "us" } };
+    long tenths;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (ns >= units[i].ns) {
+            tenths = (ns + units[i].ns / 20) / (units[i].ns / 10);
+            put_long(l, tenths / 10);
+            put_char(l, '.');
+            put_long(l, tenths % 10);
+            put_str(l, units[i].unit);
+            return;
+        }
+    }
+    put_long(l, ns);
+    put_str(l, "ns");
+}
+
+/*
+ * Pad what was put since start to width characters, with spaces on
+ * the right, or on the left to line numbers up.
+ */
+static void pad(struct line *l, size_t start, size_t width, int right)
+{
+    size_t len = l->len - start;
+
+    if (len >= width)
+        return;
+    while (l->len < start + width)
+        put_char(l, ' ');
+    if (right) {
+        memmove(l->buf + start + width - len, l->buf + start, len);
+        memset(l->buf + start, ' ', width - len);
+    }
+}
+
+static void write_line(int fd, struct line *l)
+{
+    size_t done = 0;
+    ssize_t ret;
+
+    put_char(l, '\n');
+    while (done < l->len) {
+        ret = write(fd, l->buf + done, l->len - done);
+        if (ret <= 0)
+            break;
+        done += ret;
+    }
+    l->len = 0;
+}
+
+static void dump_fd(int fd)
+{
+    struct syncprof_slot *s;
+    struct line l = { .len = 0 };
+    size_t start;
+    int i, k, nslots;
+
+    nslots = __atomic_load_n(&page->nslots, __ATOMIC_RELAXED);
+    put_str(&l, "syncprof: ");
+    put_long(&l, nslots);
+    put_str(&l, " semaphores and locks");
+    write_line(fd, &l);
+
+    for (i = 0; i < nslots; i++) {
+        s = &page->slots[i];
+        put_str(&l, s->name);
+        pad(&l, 0, 24, 0);
+        put_str(&l, " waits ");
+        put_long(&l, s->waits);
+        put_str(&l, " signals ");
+        put_long(&l, s->signals);
+        put_str(&l, " blocked ");
+        put_ns(&l, s->total_ns);
+        put_str(&l, " avg ");
+        put_ns(&l, s->waits ? s->total_ns / s->waits : 0);
+        put_str(&l, " max ");
+        put_ns(&l, s->max_ns);
+        write_line(fd, &l);
+
+        for (k = 0; k < SYNCPROF_BUCKETS; k++) {
+            if (s->hist[k] == 0)
+                continue;
+            put_str(&l, "    ");
+            start = l.len;
+            put_ns(&l, k ? 1L << (k - 1) : 0);
+            pad(&l, start, 8, 1);
+            put_str(&l, " .. ");
+            start = l.len;
+            put_ns(&l, 1L << k);
+            pad(&l, start, 8, 0);
+            put_char(&l, ' ');
+            put_long(&l, s->hist[k]);
+            write_line(fd, &l);
+        }
+    }
+}
+
+void syncprof_dump(FILE *file)
+{
+    if (page == NULL)
+        return;
+
+    fflush(file);
+    dump_fd(fileno(file));
+}
@@ -0,0 +1,47 @@
+/*
+ * syncprof.h
+ *
+ * An opt-in contention profiler for pipesem and the
+ * shared-memory locks, enabled by setting SYNCPROF in the
+ * environment of the program.
+ *
+ * Every semaphore or lock created while profiling is enabled
+ * gets a slot in a stats page shared by all the processes:
+ * how many times it was waited on and signaled, the total and
+ * maximum time spent waiting, and a histogram of wait times in
+ * powers of two nanoseconds. The process that created the page
+ * prints it to stderr when it exits, or when it is killed by
+ * SIGINT or SIGTERM.
+ *
+ * When profiling is disabled, slots are -1 and cost nothing
+ * but a comparison.
+ */
+
+#ifndef SYNCPROF_H__
+#define SYNCPROF_H__
+
+#include <stdio.h>
+
+#define SYNCPROF_SLOTS   64
+#define SYNCPROF_NAME    32
+#define SYNCPROF_BUCKETS 36	/* 1ns up to 17s, and longer */
+
+struct syncprof_slot {
+	char name[SYNCPROF_NAME];
+	long waits;
+	long signals;
+	long total_ns;
+	long max_ns;
+	long hist[SYNCPROF_BUCKETS];	/* hist[k]: waits of [2^(k-1), 2^k) ns */
+};
+
+/*
+ * Function prototypes
+ */
+int syncprof_register(const char *name);
+long syncprof_now(void);
+void syncprof_wait(int slot, long start_ns);
+void syncprof_signal(int slot, int n);
+void syncprof_dump(FILE *file);
+
+#endif /* SYNCPROF_H__ */